@@ -0,0 +1,1499 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <malloc.h>
+#include "redblack_bst.h"
+#include "redblack_io.h"
+#include "redblack_concurrent.h"
+#include "redblack_parallel.h"
+#include "redblack_buffer.h"
+#include "redblack_shard.h"
+#include "redblack_typed.h"
+
+#define BUCKET_SUB_BITS 4
+#define BUCKET_NUM (64 << BUCKET_SUB_BITS)
+#define PAGE_SIZE 100
+
+typedef struct {
+    uint64_t roleid;
+    uint64_t score;
+} Score;
+
+/* latencies are kept in log-linear buckets so 50M-op runs need no per-op storage */
+typedef struct {
+    uint64_t bucket_num[BUCKET_NUM];
+    uint64_t op_num;
+    uint64_t cmp_num;
+    uint64_t start_cmp_num;
+    uint64_t start_ns;
+    uint64_t ns;
+} Recorder;
+
+typedef enum {
+    BACKEND_REDBLACK,
+    BACKEND_INLINE_KEY,
+    BACKEND_BTREE,
+    BACKEND_COMPACT,
+} Backend;
+
+typedef enum {
+    TRIM_DELETE_MIN,
+    TRIM_BY_RANK,
+    TRIM_BY_SCORE,
+} TrimMode;
+
+typedef struct {
+    size_t op_num;
+    int max_thread_num;
+} BenchConfig;
+
+typedef struct {
+    const char *name;
+    void (*func)(const BenchConfig *config, size_t n);
+} Workload;
+
+static const char *backend_names[] = {"redblack", "inline_key", "btree", "compact"};
+static const char *trim_names[] = {"delete_min", "delete_range_by_rank", "delete_range_by_score"};
+
+static __thread uint64_t cmp_num;
+static size_t page_item_num;
+
+REDBLACK_DEFINE(score, uint64_t, (a > b) - (a < b))
+
+static int
+cmp_func(void *data1, void *data2) {
+    Score *score1 = (Score *)data1;
+    Score *score2 = (Score *)data2;
+    cmp_num++;
+    if(score1->roleid == score2->roleid)
+        return 0;
+    if(score1->score > score2->score)
+        return 1;
+    else if(score1->score < score2->score)
+        return -1;
+    else
+        return score1->roleid < score2->roleid ? -1 : 1;
+}
+
+static int
+cmp_score_func(void *data1, void *data2) {
+    Score *score1 = (Score *)data1;
+    Score *score2 = (Score *)data2;
+    cmp_num++;
+    return (score1->score > score2->score) - (score1->score < score2->score);
+}
+
+static void
+update_func(void *data1, void *data2) {
+    Score *score1 = (Score *)data1;
+    Score *score2 = (Score *)data2;
+    score1->score = score2->score;
+    score1->roleid = score2->roleid;
+}
+
+static void
+free_func(void *data) {
+    free(data);
+}
+
+static void
+keep_func(void *data) {
+}
+
+static void *
+copy_func(void *data) {
+    Score *score = malloc(sizeof(*score));
+    *score = *(Score *)data;
+    return score;
+}
+
+static uint64_t
+get_id_func(void *data) {
+    return ((Score *)data)->roleid;
+}
+
+static uint64_t
+get_key_func(void *data) {
+    return ((Score *)data)->score;
+}
+
+static void
+page_func(void *data) {
+    page_item_num++;
+}
+
+static uint64_t
+rand64(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static uint64_t
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t
+rss_kb(void) {
+    size_t page_num = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if(file == NULL)
+        return 0;
+    if(fscanf(file, "%*s %zu", &page_num) != 1)
+        page_num = 0;
+    fclose(file);
+    return page_num * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+/* bytes handed out by malloc and not yet freed, which unlike rss drops when a tree is freed */
+static size_t
+heap_bytes(void) {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+static int
+bucket_of(uint64_t ns) {
+    if(ns < (1 << BUCKET_SUB_BITS))
+        return ns;
+    int msb = 63 - __builtin_clzll(ns);
+    int sub = (ns >> (msb - BUCKET_SUB_BITS)) & ((1 << BUCKET_SUB_BITS) - 1);
+    return ((msb - BUCKET_SUB_BITS + 1) << BUCKET_SUB_BITS) + sub;
+}
+
+static uint64_t
+bucket_value(int bucket) {
+    if(bucket < (1 << BUCKET_SUB_BITS))
+        return bucket;
+    int shift = (bucket >> BUCKET_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)((1 << BUCKET_SUB_BITS) + (bucket & ((1 << BUCKET_SUB_BITS) - 1))) << shift;
+    return low + ((1ULL << shift) >> 1);
+}
+
+static void
+recorder_start(Recorder *recorder) {
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->start_cmp_num = cmp_num;
+    recorder->start_ns = now_ns();
+}
+
+static inline void
+recorder_add(Recorder *recorder, uint64_t op_start_ns) {
+    recorder->bucket_num[bucket_of(now_ns() - op_start_ns)]++;
+    recorder->op_num++;
+}
+
+/* a bulk operation is recorded as op_num ops of its average latency */
+static void
+recorder_add_bulk(Recorder *recorder, uint64_t op_start_ns, size_t op_num) {
+    uint64_t ns = now_ns() - op_start_ns;
+    recorder->bucket_num[bucket_of(ns / (op_num ? op_num : 1))] += op_num;
+    recorder->op_num += op_num;
+}
+
+static void
+recorder_stop(Recorder *recorder) {
+    recorder->ns = now_ns() - recorder->start_ns;
+    recorder->cmp_num += cmp_num - recorder->start_cmp_num;
+}
+
+static void
+recorder_merge(Recorder *recorder, Recorder *other) {
+    for(int i = 0;i < BUCKET_NUM;i++)
+        recorder->bucket_num[i] += other->bucket_num[i];
+    recorder->op_num += other->op_num;
+    recorder->cmp_num += other->cmp_num;
+}
+
+static uint64_t
+recorder_percentile(Recorder *recorder, double percentile) {
+    uint64_t target = (uint64_t)(recorder->op_num * percentile);
+    uint64_t seen = 0;
+    for(int i = 0;i < BUCKET_NUM;i++) {
+        seen += recorder->bucket_num[i];
+        if(seen > target)
+            return bucket_value(i);
+    }
+    return 0;
+}
+
+static void
+report(Recorder *recorder, const char *workload, const char *variant, size_t n) {
+    uint64_t op_num = recorder->op_num ? recorder->op_num : 1;
+    printf("%s,%s,%zu,%"PRIu64",%.0f,%"PRIu64",%"PRIu64",%"PRIu64",%.2f,%zu\n", workload, variant, n,
+        recorder->op_num, recorder->op_num / (recorder->ns / 1e9), recorder_percentile(recorder, 0.5),
+        recorder_percentile(recorder, 0.99), recorder_percentile(recorder, 0.999),
+        (double)recorder->cmp_num / op_num, rss_kb());
+    fflush(stdout);
+}
+
+static size_t
+page_start_num(size_t n) {
+    return n > PAGE_SIZE ? n - PAGE_SIZE + 1 : 1;
+}
+
+static RedBlackBST *
+new_tree_with_free(Backend backend, FreeFunc item_free_func) {
+    if(backend == BACKEND_BTREE)
+        return redblack_new_btree(cmp_func, update_func, item_free_func, get_key_func);
+    if(backend == BACKEND_COMPACT)
+        return redblack_new_compact(cmp_func, update_func, item_free_func);
+    RedBlackBST *tree = redblack_new_with_pool(cmp_func, update_func, item_free_func, NULL, 4096);
+    if(backend == BACKEND_INLINE_KEY)
+        redblack_set_key_func(tree, get_key_func);
+    return tree;
+}
+
+static RedBlackBST *
+new_tree(Backend backend) {
+    return new_tree_with_free(backend, free_func);
+}
+
+static RedBlackBST *
+build_tree(Score *scores, size_t n, uint64_t *state, Backend backend) {
+    RedBlackBST *tree = new_tree(backend);
+    for(size_t i = 0;i < n;i++) {
+        scores[i].roleid = i;
+        scores[i].score = rand64(state) % (n * 4);
+        Score *score = malloc(sizeof(*score));
+        *score = scores[i];
+        redblack_insert(tree, score);
+    }
+    return tree;
+}
+
+static void
+bench_insert_variant(size_t n, Backend backend, bool sequential) {
+    uint64_t state = 88172645463325252ULL;
+    RedBlackBST *tree = new_tree(backend);
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < n;i++) {
+        Score *score = malloc(sizeof(*score));
+        score->roleid = i;
+        score->score = sequential ? i : rand64(&state) % (n * 4);
+        uint64_t start = now_ns();
+        redblack_insert(tree, score);
+        recorder_add(&recorder, start);
+    }
+    recorder_stop(&recorder);
+    char variant[64];
+    snprintf(variant, sizeof(variant), "%s_%s", sequential ? "sequential" : "random", backend_names[backend]);
+    report(&recorder, "insert", variant, n);
+    redblack_free(tree);
+}
+
+static void
+bench_build_sorted(size_t n) {
+    void **items = malloc(n * sizeof(*items));
+    for(size_t i = 0;i < n;i++) {
+        Score *score = malloc(sizeof(*score));
+        score->roleid = i;
+        score->score = i / 2;
+        items[i] = score;
+    }
+    RedBlackBST *tree = new_tree(BACKEND_REDBLACK);
+    Recorder recorder;
+    recorder_start(&recorder);
+    uint64_t start = now_ns();
+    redblack_build_sorted(tree, items, n);
+    recorder_add_bulk(&recorder, start, n);
+    recorder_stop(&recorder);
+    report(&recorder, "insert", "build_sorted", n);
+    redblack_free(tree);
+    free(items);
+}
+
+static void
+bench_insert(const BenchConfig *config, size_t n) {
+    bench_insert_variant(n, BACKEND_REDBLACK, false);
+    bench_insert_variant(n, BACKEND_REDBLACK, true);
+    bench_insert_variant(n, BACKEND_INLINE_KEY, false);
+    bench_insert_variant(n, BACKEND_BTREE, false);
+    bench_insert_variant(n, BACKEND_BTREE, true);
+    bench_insert_variant(n, BACKEND_COMPACT, false);
+    bench_insert_variant(n, BACKEND_COMPACT, true);
+    bench_build_sorted(n);
+}
+
+/* the items live in one block allocated before the baseline, so the growth is what the backend spends */
+static void
+bench_memory_variant(size_t n, Backend backend) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    for(size_t i = 0;i < n;i++) {
+        scores[i].roleid = i;
+        scores[i].score = rand64(&state) % (n * 4);
+    }
+    size_t start_bytes = heap_bytes();
+    RedBlackBST *tree = new_tree_with_free(backend, keep_func);
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < n;i++) {
+        uint64_t start = now_ns();
+        redblack_insert(tree, &scores[i]);
+        recorder_add(&recorder, start);
+    }
+    recorder_stop(&recorder);
+    char variant[64];
+    snprintf(variant, sizeof(variant), "%s_%.1f_bytes_per_item", backend_names[backend],
+        (double)(heap_bytes() - start_bytes) / n);
+    report(&recorder, "memory", variant, n);
+    redblack_free(tree);
+    free(scores);
+}
+
+static void
+bench_memory(const BenchConfig *config, size_t n) {
+    bench_memory_variant(n, BACKEND_REDBLACK);
+    bench_memory_variant(n, BACKEND_BTREE);
+    bench_memory_variant(n, BACKEND_COMPACT);
+}
+
+/* the pause seen by the thread freeing a tree: all of it for redblack_free, the detach and every bounded
+ * reclaim step for an incremental reclaimer, only the detach for a background one */
+static void
+bench_teardown_variant(size_t n, size_t round_num, bool owned, size_t reclaim_node_num, bool background) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackReclaimer *reclaimer = reclaim_node_num || background ? redblack_reclaimer_new(background) : NULL;
+    Recorder recorder;
+    memset(&recorder, 0, sizeof(recorder));
+    uint64_t ns = 0;
+    for(size_t round = 0;round < round_num;round++) {
+        RedBlackBST *tree;
+        if(owned)
+            tree = build_tree(scores, n, &state, BACKEND_REDBLACK);
+        else {
+            tree = new_tree_with_free(BACKEND_REDBLACK, NULL);
+            for(size_t i = 0;i < n;i++) {
+                scores[i].roleid = i;
+                scores[i].score = rand64(&state) % (n * 4);
+                redblack_insert(tree, &scores[i]);
+            }
+        }
+        Recorder round_recorder;
+        recorder_start(&round_recorder);
+        uint64_t start = now_ns();
+        if(reclaimer == NULL)
+            redblack_free(tree);
+        else
+            redblack_free_deferred(reclaimer, tree);
+        recorder_add(&round_recorder, start);
+        if(reclaim_node_num) {
+            bool more = true;
+            while(more) {
+                start = now_ns();
+                more = redblack_reclaim(reclaimer, reclaim_node_num);
+                recorder_add(&round_recorder, start);
+            }
+        }
+        recorder_stop(&round_recorder);
+        recorder_merge(&recorder, &round_recorder);
+        ns += round_recorder.ns;
+    }
+    if(reclaimer)
+        redblack_reclaimer_free(reclaimer);
+    recorder.ns = ns;
+    char variant[64];
+    if(background)
+        snprintf(variant, sizeof(variant), "%s_background", owned ? "owned" : "unowned");
+    else if(reclaim_node_num)
+        snprintf(variant, sizeof(variant), "%s_reclaim_%zu", owned ? "owned" : "unowned", reclaim_node_num);
+    else
+        snprintf(variant, sizeof(variant), "%s_free", owned ? "owned" : "unowned");
+    report(&recorder, "teardown", variant, n);
+    free(scores);
+}
+
+static void
+bench_teardown(const BenchConfig *config, size_t n) {
+    size_t round_num = 4;
+    bench_teardown_variant(n, round_num, true, 0, false);
+    bench_teardown_variant(n, round_num, true, 1024, false);
+    bench_teardown_variant(n, round_num, true, 0, true);
+    bench_teardown_variant(n, round_num, false, 0, false);
+    bench_teardown_variant(n, round_num, false, 1024, false);
+}
+
+static void
+bench_delete_variant(size_t n, size_t op_num, bool pre_search) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, BACKEND_REDBLACK);
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        Score *old_score = &scores[rand64(&state) % n];
+        uint64_t start = now_ns();
+        if(pre_search && redblack_get(tree, old_score) == NULL)
+            continue;
+        redblack_delete(tree, old_score);
+        recorder_add(&recorder, start);
+
+        uint64_t reinsert_cmp_num = cmp_num;
+        old_score->score = rand64(&state) % (n * 4);
+        Score *score = malloc(sizeof(*score));
+        *score = *old_score;
+        redblack_insert(tree, score);
+        recorder.start_cmp_num += cmp_num - reinsert_cmp_num;
+    }
+    recorder_stop(&recorder);
+    report(&recorder, "delete", pre_search ? "get+delete" : "delete", n);
+    redblack_free(tree);
+    free(scores);
+}
+
+static void
+bench_delete(const BenchConfig *config, size_t n) {
+    bench_delete_variant(n, config->op_num, true);
+    bench_delete_variant(n, config->op_num, false);
+}
+
+static void
+bench_get_variant(size_t n, size_t op_num, Backend backend) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, backend);
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        Score *probe = &scores[rand64(&state) % n];
+        uint64_t start = now_ns();
+        Score *score = redblack_get(tree, probe);
+        recorder_add(&recorder, start);
+        assert(score);
+    }
+    recorder_stop(&recorder);
+    report(&recorder, "get", backend_names[backend], n);
+    redblack_free(tree);
+    free(scores);
+}
+
+static int
+cmp_u64_func(void *data1, void *data2) {
+    uint64_t key1 = *(uint64_t *)data1;
+    uint64_t key2 = *(uint64_t *)data2;
+    cmp_num++;
+    return (key1 > key2) - (key1 < key2);
+}
+
+static void
+bench_typed_variant(size_t n, size_t op_num, bool typed) {
+    uint64_t state = 88172645463325252ULL;
+    uint64_t *keys = malloc(n * sizeof(*keys));
+    for(size_t i = 0;i < n;i++)
+        keys[i] = rand64(&state);
+    score_tree typed_tree;
+    score_init(&typed_tree);
+    RedBlackBST *tree = redblack_new_with_pool(cmp_u64_func, NULL, free_func, NULL, 4096);
+    for(size_t i = 0;i < n;i++) {
+        if(typed)
+            score_insert(&typed_tree, keys[i]);
+        else {
+            uint64_t *key = malloc(sizeof(*key));
+            *key = keys[i];
+            redblack_insert(tree, key);
+        }
+    }
+    size_t found_num = 0;
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        uint64_t key = keys[rand64(&state) % n];
+        uint64_t start = now_ns();
+        if(typed)
+            found_num += score_get(&typed_tree, key) != NULL;
+        else
+            found_num += redblack_get(tree, &key) != NULL;
+        recorder_add(&recorder, start);
+    }
+    recorder_stop(&recorder);
+    assert(found_num == op_num);
+    report(&recorder, "get", typed ? "typed_u64" : "generic_u64", n);
+    score_free(&typed_tree);
+    redblack_free(tree);
+    free(keys);
+}
+
+static void
+bench_get(const BenchConfig *config, size_t n) {
+    bench_get_variant(n, config->op_num, BACKEND_REDBLACK);
+    bench_get_variant(n, config->op_num, BACKEND_INLINE_KEY);
+    bench_get_variant(n, config->op_num, BACKEND_BTREE);
+    bench_get_variant(n, config->op_num, BACKEND_COMPACT);
+    bench_typed_variant(n, config->op_num, false);
+    bench_typed_variant(n, config->op_num, true);
+}
+
+static void
+bench_rank_variant(size_t n, size_t op_num, Backend backend) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, backend);
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        size_t rank = rand64(&state) % n + 1;
+        uint64_t start = now_ns();
+        Score *score = redblack_get_by_rank(tree, rank);
+        recorder_add(&recorder, start);
+        assert(score);
+    }
+    recorder_stop(&recorder);
+    report(&recorder, "get_by_rank", backend_names[backend], n);
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        Score *probe = &scores[rand64(&state) % n];
+        uint64_t start = now_ns();
+        size_t rank = redblack_rank_of(tree, probe);
+        recorder_add(&recorder, start);
+        assert(rank);
+    }
+    recorder_stop(&recorder);
+    report(&recorder, "rank_of", backend_names[backend], n);
+    redblack_free(tree);
+    free(scores);
+}
+
+static void
+bench_rank(const BenchConfig *config, size_t n) {
+    bench_rank_variant(n, config->op_num, BACKEND_REDBLACK);
+    bench_rank_variant(n, config->op_num, BACKEND_INLINE_KEY);
+    bench_rank_variant(n, config->op_num, BACKEND_BTREE);
+    bench_rank_variant(n, config->op_num, BACKEND_COMPACT);
+}
+
+static void
+bench_update_variant(size_t n, size_t op_num, bool update_key, uint64_t max_step, size_t snapshot_interval) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, BACKEND_REDBLACK);
+    redblack_set_id_func(tree, get_id_func);
+    redblack_set_copy_func(tree, copy_func);
+    RedBlackBST *snapshot = NULL;
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        uint64_t start = now_ns();
+        if(snapshot_interval && i % snapshot_interval == 0) {
+            if(snapshot)
+                redblack_free(snapshot);
+            snapshot = redblack_snapshot(tree);
+        }
+        Score *old_score = &scores[rand64(&state) % n];
+        uint64_t new_score = old_score->score + rand64(&state) % max_step;
+        if(update_key) {
+            Score score = {old_score->roleid, new_score};
+            redblack_update_key(tree, &score);
+        }
+        else {
+            redblack_delete(tree, old_score);
+            Score *score = malloc(sizeof(*score));
+            score->roleid = old_score->roleid;
+            score->score = new_score;
+            redblack_insert(tree, score);
+        }
+        recorder_add(&recorder, start);
+        old_score->score = new_score;
+    }
+    recorder_stop(&recorder);
+    char workload[64], variant[64];
+    snprintf(workload, sizeof(workload), "update_step%"PRIu64, max_step);
+    snprintf(variant, sizeof(variant), "%s%s", update_key ? "update_key" : "delete+insert",
+        snapshot_interval ? "+snapshot" : "");
+    report(&recorder, workload, variant, n);
+    if(snapshot)
+        redblack_free(snapshot);
+    redblack_free(tree);
+    free(scores);
+}
+
+static void
+bench_update(const BenchConfig *config, size_t n) {
+    bench_update_variant(n, config->op_num, false, 64, 0);
+    bench_update_variant(n, config->op_num, true, 64, 0);
+    bench_update_variant(n, config->op_num, false, 2, 0);
+    bench_update_variant(n, config->op_num, true, 2, 0);
+    bench_update_variant(n, config->op_num, true, 64, 1000);
+}
+
+/* nine events in ten hit the hottest hundredth of the ids, so buffers coalesce repeated updates */
+static void
+bench_write_buffer_variant(size_t n, size_t op_num, size_t flush_size) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, BACKEND_REDBLACK);
+    redblack_set_id_func(tree, get_id_func);
+    RedBlackWriteBuffer *buffer = flush_size ? redblack_write_buffer_new(tree, get_id_func, free_func,
+        flush_size, 0) : NULL;
+    size_t hot_num = n / 100 ? n / 100 : 1;
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        uint64_t r = rand64(&state);
+        Score *old_score = &scores[r % 10 ? r % hot_num : r % n];
+        old_score->score += rand64(&state) % 64;
+        uint64_t start = now_ns();
+        if(buffer) {
+            Score *score = malloc(sizeof(*score));
+            *score = *old_score;
+            redblack_write_buffer_put(buffer, score);
+        }
+        else
+            redblack_update_key(tree, old_score);
+        recorder_add(&recorder, start);
+    }
+    /* the last partial batch counts towards throughput */
+    if(buffer)
+        redblack_write_buffer_flush(buffer);
+    recorder_stop(&recorder);
+    char variant[64];
+    snprintf(variant, sizeof(variant), flush_size ? "buffer_%zu" : "update_key", flush_size);
+    report(&recorder, "write_buffer", variant, n);
+    if(buffer)
+        redblack_write_buffer_free(buffer);
+    redblack_free(tree);
+    free(scores);
+}
+
+static void
+bench_write_buffer(const BenchConfig *config, size_t n) {
+    bench_write_buffer_variant(n, config->op_num, 0);
+    bench_write_buffer_variant(n, config->op_num, 64);
+    bench_write_buffer_variant(n, config->op_num, 1024);
+    bench_write_buffer_variant(n, config->op_num, 16384);
+}
+
+static void
+bench_range_variant(size_t n, size_t op_num, Backend backend, bool by_score) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, backend);
+    page_item_num = 0;
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        uint64_t start = now_ns();
+        if(by_score) {
+            /* scores are drawn from [0, 4n), so a span of 4 * PAGE_SIZE holds about one page */
+            Score min = {0, rand64(&state) % (n * 4)};
+            Score max = {0, min.score + PAGE_SIZE * 4 - 1};
+            redblack_get_range_by_score(tree, &min, &max, page_func, cmp_score_func);
+        }
+        else {
+            size_t start_rank = rand64(&state) % page_start_num(n) + 1;
+            size_t end_rank = start_rank + PAGE_SIZE - 1 < n ? start_rank + PAGE_SIZE - 1 : n;
+            redblack_get_range_by_rank(tree, start_rank, end_rank, page_func);
+        }
+        recorder_add(&recorder, start);
+    }
+    recorder_stop(&recorder);
+    char variant[64];
+    snprintf(variant, sizeof(variant), "%s_%.0fitems", backend_names[backend],
+        (double)page_item_num / (op_num ? op_num : 1));
+    report(&recorder, by_score ? "range_by_score" : "range_by_rank", variant, n);
+    redblack_free(tree);
+    free(scores);
+}
+
+static void
+bench_cursor_variant(size_t n, size_t op_num, bool by_score) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, BACKEND_REDBLACK);
+    RedBlackCursor cursor;
+    redblack_cursor_init(&cursor, tree);
+    page_item_num = 0;
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        uint64_t start = now_ns();
+        bool ok;
+        if(by_score) {
+            Score min = {0, rand64(&state) % (n * 4)};
+            ok = redblack_cursor_seek_by_score(&cursor, &min, cmp_score_func);
+        }
+        else
+            ok = redblack_cursor_seek_by_rank(&cursor, rand64(&state) % page_start_num(n) + 1);
+        for(int j = 0;ok && j < PAGE_SIZE;j++) {
+            page_func(redblack_cursor_get(&cursor));
+            ok = redblack_cursor_next(&cursor);
+        }
+        recorder_add(&recorder, start);
+    }
+    recorder_stop(&recorder);
+    char variant[64];
+    snprintf(variant, sizeof(variant), "cursor_%.0fitems", (double)page_item_num / (op_num ? op_num : 1));
+    report(&recorder, by_score ? "range_by_score" : "range_by_rank", variant, n);
+    redblack_free(tree);
+    free(scores);
+}
+
+static void
+bench_top_n_variant(size_t n, size_t op_num, Backend backend) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, backend);
+    void *items[PAGE_SIZE];
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        uint64_t start = now_ns();
+        page_item_num += redblack_top_n(tree, PAGE_SIZE, items);
+        recorder_add(&recorder, start);
+    }
+    recorder_stop(&recorder);
+    char variant[64];
+    snprintf(variant, sizeof(variant), "top_n_%s", backend_names[backend]);
+    report(&recorder, "range_by_rank", variant, n);
+    redblack_free(tree);
+    free(scores);
+}
+
+static void
+bench_pop_variant(size_t n, size_t op_num, bool pop_n) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, BACKEND_REDBLACK);
+    size_t pop_num = n < PAGE_SIZE ? n : PAGE_SIZE;
+    void *items[PAGE_SIZE];
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        uint64_t start = now_ns();
+        if(pop_n)
+            redblack_pop_max_n(tree, pop_num, items);
+        else {
+            redblack_top_n(tree, pop_num, items);
+            for(size_t j = 0;j < pop_num;j++)
+                redblack_remove(tree, items[j], &items[j]);
+        }
+        recorder_add(&recorder, start);
+
+        uint64_t reinsert_cmp_num = cmp_num;
+        for(size_t j = 0;j < pop_num;j++)
+            redblack_insert(tree, items[j]);
+        recorder.start_cmp_num += cmp_num - reinsert_cmp_num;
+    }
+    recorder_stop(&recorder);
+    report(&recorder, "pop_max_100", pop_n ? "pop_max_n" : "top_n+remove", n);
+    redblack_free(tree);
+    free(scores);
+}
+
+static void
+bench_pop(const BenchConfig *config, size_t n) {
+    size_t op_num = config->op_num / PAGE_SIZE ? config->op_num / PAGE_SIZE : 1;
+    bench_pop_variant(n, op_num, true);
+    bench_pop_variant(n, op_num, false);
+}
+
+/* evicts the lowest tenth of a fresh tree per round; the range deletes are recorded as one op per item */
+static void
+bench_delete_range_variant(size_t n, size_t round_num, TrimMode mode) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    size_t trim_num = n / 10 ? n / 10 : 1;
+    Recorder recorder;
+    memset(&recorder, 0, sizeof(recorder));
+    uint64_t ns = 0;
+    for(size_t round = 0;round < round_num;round++) {
+        RedBlackBST *tree = build_tree(scores, n, &state, BACKEND_REDBLACK);
+        Score max_score = {0, ((Score *)redblack_get_by_rank(tree, trim_num))->score};
+        Score min_score = {0, 0};
+        Recorder round_recorder;
+        recorder_start(&round_recorder);
+        uint64_t start = now_ns();
+        if(mode == TRIM_DELETE_MIN) {
+            for(size_t i = 0;i < trim_num;i++) {
+                start = now_ns();
+                redblack_delete_min(tree);
+                recorder_add(&round_recorder, start);
+            }
+        }
+        else if(mode == TRIM_BY_RANK)
+            recorder_add_bulk(&round_recorder, start, redblack_delete_range_by_rank(tree, 1, trim_num));
+        else
+            recorder_add_bulk(&round_recorder, start,
+                redblack_delete_range_by_score(tree, &min_score, &max_score, cmp_score_func));
+        recorder_stop(&round_recorder);
+        recorder_merge(&recorder, &round_recorder);
+        ns += round_recorder.ns;
+        redblack_free(tree);
+    }
+    recorder.ns = ns;
+    report(&recorder, "delete_range", trim_names[mode], n);
+    free(scores);
+}
+
+static void
+bench_delete_range(const BenchConfig *config, size_t n) {
+    size_t round_num = config->op_num / (n / 10 + 1);
+    if(round_num < 1)
+        round_num = 1;
+    if(round_num > 8)
+        round_num = 8;
+    bench_delete_range_variant(n, round_num, TRIM_DELETE_MIN);
+    bench_delete_range_variant(n, round_num, TRIM_BY_RANK);
+    bench_delete_range_variant(n, round_num, TRIM_BY_SCORE);
+}
+
+static void
+bench_split_join(size_t n, size_t op_num) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, BACKEND_REDBLACK);
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        Score pivot = {UINT64_MAX, rand64(&state) % (n * 4)};
+        uint64_t start = now_ns();
+        RedBlackBST *left, *right;
+        redblack_split(tree, &pivot, &left, &right);
+        redblack_join(left, right);
+        recorder_add(&recorder, start);
+    }
+    recorder_stop(&recorder);
+    report(&recorder, "split_join", "redblack", n);
+    redblack_free(tree);
+    free(scores);
+}
+
+static void
+bench_union_variant(size_t n, bool use_union) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, BACKEND_REDBLACK);
+    size_t other_num = n / 16 ? n / 16 : 1;
+    RedBlackBST *other = new_tree(BACKEND_REDBLACK);
+    Score **items = malloc(other_num * sizeof(*items));
+    for(size_t i = 0;i < other_num;i++) {
+        items[i] = malloc(sizeof(Score));
+        items[i]->roleid = n + i;
+        items[i]->score = rand64(&state) % (n * 4);
+        if(use_union)
+            redblack_insert(other, items[i]);
+    }
+    Recorder recorder;
+    recorder_start(&recorder);
+    uint64_t start = now_ns();
+    if(use_union)
+        redblack_union(tree, other);
+    else {
+        for(size_t i = 0;i < other_num;i++)
+            redblack_insert(tree, items[i]);
+        redblack_free(other);
+    }
+    recorder_add_bulk(&recorder, start, other_num);
+    recorder_stop(&recorder);
+    report(&recorder, "merge_n/16", use_union ? "union" : "insert", n);
+    redblack_free(tree);
+    free(items);
+    free(scores);
+}
+
+static void
+bench_merge(const BenchConfig *config, size_t n) {
+    bench_split_join(n, config->op_num);
+    bench_union_variant(n, true);
+    bench_union_variant(n, false);
+}
+
+static void
+bench_range_by_score(const BenchConfig *config, size_t n) {
+    bench_range_variant(n, config->op_num, BACKEND_REDBLACK, true);
+    bench_range_variant(n, config->op_num, BACKEND_INLINE_KEY, true);
+    bench_range_variant(n, config->op_num, BACKEND_BTREE, true);
+    bench_range_variant(n, config->op_num, BACKEND_COMPACT, true);
+    bench_cursor_variant(n, config->op_num, true);
+}
+
+static void
+bench_range_by_rank(const BenchConfig *config, size_t n) {
+    bench_range_variant(n, config->op_num, BACKEND_REDBLACK, false);
+    bench_range_variant(n, config->op_num, BACKEND_BTREE, false);
+    bench_range_variant(n, config->op_num, BACKEND_COMPACT, false);
+    bench_cursor_variant(n, config->op_num, false);
+    bench_top_n_variant(n, config->op_num, BACKEND_REDBLACK);
+    bench_top_n_variant(n, config->op_num, BACKEND_BTREE);
+    bench_top_n_variant(n, config->op_num, BACKEND_COMPACT);
+}
+
+static size_t
+serialize_func(void *data, void *buffer, size_t buffer_size) {
+    if(buffer_size >= sizeof(Score))
+        memcpy(buffer, data, sizeof(Score));
+    return sizeof(Score);
+}
+
+static void *
+deserialize_func(const void *buffer, size_t size) {
+    Score *score = malloc(sizeof(*score));
+    memcpy(score, buffer, sizeof(*score));
+    return score;
+}
+
+static void
+bench_snapshot(const BenchConfig *config, size_t n) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, BACKEND_REDBLACK);
+    char path[] = "/tmp/redblack_bench_XXXXXX";
+    int fd = mkstemp(path);
+    unlink(path);
+    Recorder recorder;
+    recorder_start(&recorder);
+    uint64_t start = now_ns();
+    redblack_save(tree, fd, serialize_func);
+    recorder_add_bulk(&recorder, start, n);
+    recorder_stop(&recorder);
+    report(&recorder, "snapshot", "save", n);
+    RedBlackBST *loaded = new_tree(BACKEND_REDBLACK);
+    recorder_start(&recorder);
+    start = now_ns();
+    redblack_load(loaded, fd, deserialize_func);
+    recorder_add_bulk(&recorder, start, n);
+    recorder_stop(&recorder);
+    report(&recorder, "snapshot", "load", n);
+    close(fd);
+    redblack_free(loaded);
+    redblack_free(tree);
+    free(scores);
+}
+
+typedef struct {
+    RedBlackConcurrent *concurrent;
+    RedBlackShard *shard;
+    RedBlackBST *tree;
+    pthread_mutex_t *lock;
+    size_t n;
+    size_t op_num;
+    uint64_t state;
+    Recorder recorder;
+    bool stop;
+} BenchThread;
+
+static void *
+concurrent_reader(void *arg) {
+    BenchThread *thread = arg;
+    int reader = thread->concurrent ? redblack_concurrent_register_reader(thread->concurrent) : 0;
+    recorder_start(&thread->recorder);
+    for(size_t i = 0;i < thread->op_num;i++) {
+        uint64_t start = now_ns();
+        RedBlackBST *tree = thread->tree;
+        if(thread->concurrent)
+            tree = redblack_concurrent_read_begin(thread->concurrent, reader);
+        else
+            pthread_mutex_lock(thread->lock);
+        Score *score = redblack_get_by_rank(tree, rand64(&thread->state) % thread->n + 1);
+        redblack_rank_of(tree, score);
+        if(thread->concurrent)
+            redblack_concurrent_read_end(thread->concurrent, reader);
+        else
+            pthread_mutex_unlock(thread->lock);
+        recorder_add(&thread->recorder, start);
+    }
+    recorder_stop(&thread->recorder);
+    return NULL;
+}
+
+static void *
+concurrent_writer(void *arg) {
+    BenchThread *thread = arg;
+    while(!__atomic_load_n(&thread->stop, __ATOMIC_ACQUIRE)) {
+        RedBlackBST *tree = thread->tree;
+        if(thread->concurrent)
+            tree = redblack_concurrent_write_begin(thread->concurrent);
+        else
+            pthread_mutex_lock(thread->lock);
+        for(int i = 0;i < 16;i++) {
+            Score score = {rand64(&thread->state) % thread->n, rand64(&thread->state) % (thread->n * 4)};
+            redblack_update_key(tree, &score);
+        }
+        if(thread->concurrent)
+            redblack_concurrent_write_end(thread->concurrent);
+        else
+            pthread_mutex_unlock(thread->lock);
+    }
+    return NULL;
+}
+
+static void
+bench_concurrent_variant(size_t n, size_t op_num, int reader_num, bool lock_free) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, BACKEND_REDBLACK);
+    redblack_set_id_func(tree, get_id_func);
+    redblack_set_copy_func(tree, copy_func);
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    RedBlackConcurrent *concurrent = lock_free ? redblack_concurrent_new(tree, reader_num) : NULL;
+    BenchThread *threads = calloc(reader_num + 1, sizeof(*threads));
+    pthread_t *ids = malloc((reader_num + 1) * sizeof(*ids));
+    for(int i = 0;i <= reader_num;i++) {
+        threads[i].concurrent = concurrent;
+        threads[i].tree = tree;
+        threads[i].lock = &lock;
+        threads[i].n = n;
+        threads[i].op_num = op_num / reader_num;
+        threads[i].state = state + i * 0x9e3779b97f4a7c15ULL;
+    }
+    Recorder recorder;
+    recorder_start(&recorder);
+    pthread_create(&ids[reader_num], NULL, concurrent_writer, &threads[reader_num]);
+    for(int i = 0;i < reader_num;i++)
+        pthread_create(&ids[i], NULL, concurrent_reader, &threads[i]);
+    for(int i = 0;i < reader_num;i++) {
+        pthread_join(ids[i], NULL);
+        recorder_merge(&recorder, &threads[i].recorder);
+    }
+    recorder_stop(&recorder);
+    __atomic_store_n(&threads[reader_num].stop, true, __ATOMIC_RELEASE);
+    pthread_join(ids[reader_num], NULL);
+    char variant[64];
+    snprintf(variant, sizeof(variant), "%s_%dreaders", lock_free ? "epoch" : "mutex", reader_num);
+    report(&recorder, "concurrent_read", variant, n);
+    if(concurrent)
+        redblack_concurrent_free(concurrent);
+    else
+        redblack_free(tree);
+    free(threads);
+    free(ids);
+    free(scores);
+}
+
+static void
+bench_concurrent(const BenchConfig *config, size_t n) {
+    for(int reader_num = 1;reader_num <= config->max_thread_num;reader_num *= 2) {
+        bench_concurrent_variant(n, config->op_num, reader_num, false);
+        bench_concurrent_variant(n, config->op_num, reader_num, true);
+    }
+}
+
+static void
+sum_func(void *acc, void *data) {
+    *(uint64_t *)acc += ((Score *)data)->score;
+}
+
+static void
+reduce_sum_func(void *acc, void *other_acc) {
+    *(uint64_t *)acc += *(uint64_t *)other_acc;
+}
+
+static void **
+new_sorted_items(size_t n) {
+    void **items = malloc(n * sizeof(*items));
+    for(size_t i = 0;i < n;i++) {
+        Score *score = malloc(sizeof(*score));
+        score->roleid = i;
+        score->score = i;
+        items[i] = score;
+    }
+    return items;
+}
+
+static void
+bench_parallel_variant(size_t n, size_t op_num, int thread_num) {
+    uint64_t state = 88172645463325252ULL;
+    RedBlackThreadPool *thread_pool = redblack_thread_pool_new(thread_num);
+    char variant[64];
+    Recorder recorder;
+
+    void **items = new_sorted_items(n);
+    RedBlackBST *tree = new_tree(BACKEND_REDBLACK);
+    recorder_start(&recorder);
+    uint64_t start = now_ns();
+    redblack_build_sorted_parallel(tree, items, n, thread_pool);
+    recorder_add_bulk(&recorder, start, n);
+    recorder_stop(&recorder);
+    snprintf(variant, sizeof(variant), "build_%dthreads", thread_num);
+    report(&recorder, "parallel", variant, n);
+    free(items);
+
+    size_t map_num = op_num / n ? op_num / n : 1;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < map_num;i++) {
+        uint64_t sum = 0;
+        start = now_ns();
+        redblack_map_range(tree, 1, n, sum_func, reduce_sum_func, &sum, sizeof(sum), thread_pool);
+        recorder_add_bulk(&recorder, start, n);
+        assert(sum == (uint64_t)n * (n - 1) / 2);
+    }
+    recorder_stop(&recorder);
+    snprintf(variant, sizeof(variant), "map_range_%dthreads", thread_num);
+    report(&recorder, "parallel", variant, n);
+    redblack_free(tree);
+
+    Score *scores = malloc(n * sizeof(*scores));
+    tree = build_tree(scores, n / 2, &state, BACKEND_REDBLACK);
+    RedBlackBST *other = new_tree(BACKEND_REDBLACK);
+    for(size_t i = 0;i < n - n / 2;i++) {
+        Score *score = malloc(sizeof(*score));
+        score->roleid = n + i;
+        score->score = rand64(&state) % (n * 4);
+        redblack_insert(other, score);
+    }
+    recorder_start(&recorder);
+    start = now_ns();
+    redblack_union_parallel(tree, &other, 1, thread_pool);
+    recorder_add_bulk(&recorder, start, n);
+    recorder_stop(&recorder);
+    snprintf(variant, sizeof(variant), "union_%dthreads", thread_num);
+    report(&recorder, "parallel", variant, n);
+    redblack_free(tree);
+    free(scores);
+    redblack_thread_pool_free(thread_pool);
+}
+
+static void
+bench_parallel(const BenchConfig *config, size_t n) {
+    for(int thread_num = 1;thread_num <= config->max_thread_num;thread_num *= 2)
+        bench_parallel_variant(n, config->op_num, thread_num);
+}
+
+#define SHARD_NUM 8
+#define SHARD_TOP_N 100
+
+static void *
+shard_writer(void *arg) {
+    BenchThread *thread = arg;
+    recorder_start(&thread->recorder);
+    for(size_t i = 0;i < thread->op_num;i++) {
+        Score score = {rand64(&thread->state) % thread->n, rand64(&thread->state) % (thread->n * 4)};
+        uint64_t start = now_ns();
+        RedBlackBST *tree = redblack_shard_write_begin(thread->shard, score.roleid);
+        redblack_update_key(tree, &score);
+        redblack_shard_write_end(thread->shard, score.roleid);
+        recorder_add(&thread->recorder, start);
+    }
+    recorder_stop(&thread->recorder);
+    return NULL;
+}
+
+static RedBlackShard *
+build_shard(size_t n, int shard_num, uint64_t *state) {
+    RedBlackBST *trees[SHARD_NUM];
+    for(int i = 0;i < shard_num;i++) {
+        trees[i] = new_tree(BACKEND_REDBLACK);
+        redblack_set_id_func(trees[i], get_id_func);
+    }
+    RedBlackShard *shard = redblack_shard_new(trees, shard_num, cmp_func, get_id_func);
+    for(size_t i = 0;i < n;i++) {
+        Score *score = malloc(sizeof(*score));
+        score->roleid = i;
+        score->score = rand64(state) % (n * 4);
+        redblack_insert(redblack_shard_write_begin(shard, i), score);
+        redblack_shard_write_end(shard, i);
+    }
+    return shard;
+}
+
+static void
+bench_shard_write(size_t n, size_t op_num, int thread_num, int shard_num) {
+    uint64_t state = 88172645463325252ULL;
+    RedBlackShard *shard = build_shard(n, shard_num, &state);
+    BenchThread *threads = calloc(thread_num, sizeof(*threads));
+    pthread_t *ids = malloc(thread_num * sizeof(*ids));
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(int i = 0;i < thread_num;i++) {
+        threads[i].shard = shard;
+        threads[i].n = n;
+        threads[i].op_num = op_num / thread_num;
+        threads[i].state = state + i * 0x9e3779b97f4a7c15ULL;
+        pthread_create(&ids[i], NULL, shard_writer, &threads[i]);
+    }
+    for(int i = 0;i < thread_num;i++) {
+        pthread_join(ids[i], NULL);
+        recorder_merge(&recorder, &threads[i].recorder);
+    }
+    recorder_stop(&recorder);
+    char variant[64];
+    snprintf(variant, sizeof(variant), "%dshards_%dthreads", shard_num, thread_num);
+    report(&recorder, "shard_write", variant, n);
+    redblack_shard_free(shard);
+    free(threads);
+    free(ids);
+}
+
+static void
+bench_shard_query(size_t n, size_t op_num, int shard_num) {
+    uint64_t state = 88172645463325252ULL;
+    RedBlackShard *shard = build_shard(n, shard_num, &state);
+    void *items[SHARD_TOP_N];
+    char variant[64];
+    Recorder recorder;
+    redblack_shard_read_begin(shard);
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        uint64_t start = now_ns();
+        Score *score = redblack_shard_get_by_rank(shard, rand64(&state) % n + 1);
+        recorder_add(&recorder, start);
+        assert(score);
+    }
+    recorder_stop(&recorder);
+    snprintf(variant, sizeof(variant), "get_by_rank_%dshards", shard_num);
+    report(&recorder, "shard_query", variant, n);
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        size_t rank = rand64(&state) % n + 1;
+        Score *score = redblack_shard_get_by_rank(shard, rank);
+        uint64_t start = now_ns();
+        size_t found_rank = redblack_shard_rank_of(shard, score);
+        recorder_add(&recorder, start);
+        assert(found_rank == rank);
+    }
+    recorder_stop(&recorder);
+    snprintf(variant, sizeof(variant), "rank_of_%dshards", shard_num);
+    report(&recorder, "shard_query", variant, n);
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num / SHARD_TOP_N;i++) {
+        uint64_t start = now_ns();
+        size_t item_num = redblack_shard_top_n(shard, SHARD_TOP_N, items);
+        recorder_add(&recorder, start);
+        assert(item_num == (n < SHARD_TOP_N ? n : SHARD_TOP_N));
+    }
+    recorder_stop(&recorder);
+    snprintf(variant, sizeof(variant), "top_%d_%dshards", SHARD_TOP_N, shard_num);
+    report(&recorder, "shard_query", variant, n);
+    redblack_shard_read_end(shard);
+    redblack_shard_free(shard);
+}
+
+/* one shard is a single locked tree, the baseline sharding has to beat on writes and pay for on queries */
+static void
+bench_shard(const BenchConfig *config, size_t n) {
+    for(int thread_num = 1;thread_num <= config->max_thread_num;thread_num *= 2) {
+        bench_shard_write(n, config->op_num, thread_num, 1);
+        bench_shard_write(n, config->op_num, thread_num, SHARD_NUM);
+    }
+    bench_shard_query(n, config->op_num, 1);
+    bench_shard_query(n, config->op_num, SHARD_NUM);
+}
+
+#define AGGREGATE_RANGE 1000
+
+static uint64_t walk_sum;
+
+static void
+sum_aggregate_func(void *aggregate, void *data, const void *left, const void *right) {
+    uint64_t sum = ((Score *)data)->score;
+    if(left)
+        sum += *(const uint64_t *)left;
+    if(right)
+        sum += *(const uint64_t *)right;
+    *(uint64_t *)aggregate = sum;
+}
+
+static void
+walk_sum_func(void *data) {
+    walk_sum += ((Score *)data)->score;
+}
+
+static void
+bench_aggregate_variant(size_t n, size_t op_num, bool use_aggregate) {
+    uint64_t state = 88172645463325252ULL;
+    RedBlackBST *tree = redblack_new_with_pool(cmp_func, update_func, free_func, NULL, 4096);
+    if(use_aggregate)
+        redblack_set_aggregate_func(tree, sum_aggregate_func, sizeof(uint64_t));
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < n;i++) {
+        Score *score = malloc(sizeof(*score));
+        score->roleid = i;
+        score->score = rand64(&state) % (n * 4);
+        uint64_t start = now_ns();
+        redblack_insert(tree, score);
+        recorder_add(&recorder, start);
+    }
+    recorder_stop(&recorder);
+    report(&recorder, "aggregate", use_aggregate ? "insert_sum" : "insert_plain", n);
+
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        size_t start_rank = rand64(&state) % (n > AGGREGATE_RANGE ? n - AGGREGATE_RANGE + 1 : 1) + 1;
+        size_t end_rank = start_rank + AGGREGATE_RANGE - 1 < n ? start_rank + AGGREGATE_RANGE - 1 : n;
+        uint64_t sum = 0;
+        uint64_t start = now_ns();
+        if(use_aggregate)
+            redblack_aggregate_by_rank(tree, start_rank, end_rank, &sum);
+        else {
+            walk_sum = 0;
+            redblack_get_range_by_rank(tree, start_rank, end_rank, walk_sum_func);
+            sum = walk_sum;
+        }
+        recorder_add(&recorder, start);
+        assert(sum > 0);
+    }
+    recorder_stop(&recorder);
+    report(&recorder, "aggregate", use_aggregate ? "sum_by_rank_1000" : "walk_sum_1000", n);
+    redblack_free(tree);
+}
+
+static void
+bench_aggregate(const BenchConfig *config, size_t n) {
+    bench_aggregate_variant(n, config->op_num, false);
+    bench_aggregate_variant(n, config->op_num, true);
+}
+
+#define HISTOGRAM_BUCKET_NUM 10
+
+static void
+bench_distribution_variant(size_t n, size_t op_num, Backend backend) {
+    uint64_t state = 88172645463325252ULL;
+    Score *scores = malloc(n * sizeof(*scores));
+    RedBlackBST *tree = build_tree(scores, n, &state, backend);
+    Recorder recorder;
+    recorder_start(&recorder);
+    for(size_t i = 0;i < op_num;i++) {
+        uint64_t start = now_ns();
+        Score *score = redblack_quantile(tree, (rand64(&state) % 1000) / 1000.0);
+        recorder_add(&recorder, start);
+        assert(score);
+    }
+    recorder_stop(&recorder);
+    char variant[64];
+    snprintf(variant, sizeof(variant), "quantile_%s", backend_names[backend]);
+    report(&recorder, "distribution", variant, n);
+
+    Score boundaries[HISTOGRAM_BUCKET_NUM];
+    void *boundary_ptrs[HISTOGRAM_BUCKET_NUM];
+    size_t counts[HISTOGRAM_BUCKET_NUM + 1];
+    for(int variant_num = 0;variant_num < 2;variant_num++) {
+        recorder_start(&recorder);
+        for(size_t i = 0;i < op_num / HISTOGRAM_BUCKET_NUM;i++) {
+            /* a 1000-wide band of the score space around a random point, like a tier table */
+            uint64_t base = rand64(&state) % (n * 4);
+            for(int j = 0;j < HISTOGRAM_BUCKET_NUM;j++) {
+                boundaries[j].roleid = 0;
+                boundaries[j].score = base + j * 100;
+                boundary_ptrs[j] = &boundaries[j];
+            }
+            uint64_t start = now_ns();
+            if(variant_num == 0)
+                redblack_histogram(tree, boundary_ptrs, HISTOGRAM_BUCKET_NUM, cmp_score_func, counts);
+            else {
+                for(int j = 0;j < HISTOGRAM_BUCKET_NUM;j++)
+                    counts[j] = redblack_count_less_by_score(tree, boundary_ptrs[j], cmp_score_func);
+            }
+            recorder_add(&recorder, start);
+        }
+        recorder_stop(&recorder);
+        snprintf(variant, sizeof(variant), "%s_%d_%s", variant_num == 0 ? "histogram" : "count_each",
+            HISTOGRAM_BUCKET_NUM, backend_names[backend]);
+        report(&recorder, "distribution", variant, n);
+    }
+    redblack_free(tree);
+    free(scores);
+}
+
+static void
+bench_distribution(const BenchConfig *config, size_t n) {
+    bench_distribution_variant(n, config->op_num, BACKEND_REDBLACK);
+    bench_distribution_variant(n, config->op_num, BACKEND_BTREE);
+    bench_distribution_variant(n, config->op_num, BACKEND_COMPACT);
+}
+
+static const Workload workloads[] = {
+    {"insert", bench_insert},
+    {"memory", bench_memory},
+    {"teardown", bench_teardown},
+    {"delete", bench_delete},
+    {"update", bench_update},
+    {"write_buffer", bench_write_buffer},
+    {"get", bench_get},
+    {"rank", bench_rank},
+    {"range_by_score", bench_range_by_score},
+    {"range_by_rank", bench_range_by_rank},
+    {"pop", bench_pop},
+    {"delete_range", bench_delete_range},
+    {"merge", bench_merge},
+    {"snapshot", bench_snapshot},
+    {"concurrent", bench_concurrent},
+    {"parallel", bench_parallel},
+    {"shard", bench_shard},
+    {"aggregate", bench_aggregate},
+    {"distribution", bench_distribution},
+};
+
+#define WORKLOAD_NUM (sizeof(workloads) / sizeof(workloads[0]))
+
+static void
+usage(const char *name) {
+    fprintf(stderr, "usage: %s [-n size,...] [-o ops] [-w workload,...] [-t max_threads]\n", name);
+    fprintf(stderr, "sizes accept k/m suffixes, e.g. -n 1k,1m,50m\nworkloads:");
+    for(size_t i = 0;i < WORKLOAD_NUM;i++)
+        fprintf(stderr, " %s", workloads[i].name);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static size_t
+parse_size(const char *str) {
+    char *end;
+    size_t size = strtoull(str, &end, 10);
+    if(*end == 'k' || *end == 'K')
+        size *= 1000;
+    else if(*end == 'm' || *end == 'M')
+        size *= 1000000;
+    return size;
+}
+
+int main(int argc, char **argv) {
+    BenchConfig config = {1000000, (int)sysconf(_SC_NPROCESSORS_ONLN)};
+    const char *size_list = "1000000";
+    const char *workload_list = NULL;
+    int opt;
+    while((opt = getopt(argc, argv, "n:o:w:t:h")) != -1) {
+        switch(opt) {
+            case 'n': size_list = optarg; break;
+            case 'o': config.op_num = parse_size(optarg); break;
+            case 'w': workload_list = optarg; break;
+            case 't': config.max_thread_num = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    bool selected[WORKLOAD_NUM];
+    for(size_t i = 0;i < WORKLOAD_NUM;i++)
+        selected[i] = workload_list == NULL;
+    if(workload_list) {
+        char *list = strdup(workload_list);
+        for(char *name = strtok(list, ",");name;name = strtok(NULL, ",")) {
+            size_t i = 0;
+            while(i < WORKLOAD_NUM && strcmp(workloads[i].name, name) != 0)
+                i++;
+            if(i == WORKLOAD_NUM)
+                usage(argv[0]);
+            selected[i] = true;
+        }
+        free(list);
+    }
+    size_t size_num = 0;
+    size_t *sizes = malloc((strlen(size_list) / 2 + 1) * sizeof(*sizes));
+    char *list = strdup(size_list);
+    for(char *size = strtok(list, ",");size;size = strtok(NULL, ",")) {
+        sizes[size_num] = parse_size(size);
+        if(sizes[size_num++] == 0)
+            usage(argv[0]);
+    }
+    free(list);
+    printf("workload,variant,n,ops,ops_per_sec,p50_ns,p99_ns,p999_ns,cmp_per_op,rss_kb\n");
+    for(size_t i = 0;i < size_num;i++) {
+        for(size_t j = 0;j < WORKLOAD_NUM;j++) {
+            if(selected[j])
+                workloads[j].func(&config, sizes[i]);
+        }
+    }
+    free(sizes);
+    return 0;
+}
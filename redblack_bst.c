@@ -1,96 +1,697 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include "redblack_bst.h"
+#include "redblack_btree.h"
+#include "redblack_compact.h"
+#include "redblack_parallel.h"
+
+/* subproblems smaller than this are not worth handing to another thread */
+#define PARALLEL_GRAIN 4096
 
 typedef enum {RED, BLACK} Color;
 
+#ifdef REDBLACK_STATS
+#define STATS_ADD(tree, field, num) __atomic_add_fetch(&(tree)->stats.field, (num), __ATOMIC_RELAXED)
+#define STATS_BEGIN() uint64_t stats_start_ns = stats_now()
+#define STATS_END(tree, op) stats_record(tree, op, stats_start_ns)
+#else
+#define STATS_ADD(tree, field, num) ((void)0)
+#define STATS_BEGIN() ((void)0)
+#define STATS_END(tree, op) ((void)0)
+#endif
+
 struct redblack_node {
+    uint64_t key;
     void *data;
     struct redblack_node *left, *right;
     size_t sub_node_num;
     Color color;
+    uint32_t ref_num;
+};
+
+typedef struct node_slab {
+    struct node_slab *next;
+    size_t node_num;
+    RedBlackNode nodes[];
+} NodeSlab;
+
+typedef struct {
+    uint64_t id;
+    void *data;
+} IdEntry;
+
+typedef struct {
+    IdEntry *entries;
+    size_t capacity;
+    size_t entry_num;
+} IdIndex;
+
+typedef struct {
+    RedBlackNode *root;
+    int black_height;
+} SubTree;
+
+typedef struct {
+    RedBlackNode **nodes;
+    size_t n;
+    int black_height;
+    const size_t *max_num;
+    RedBlackThreadPool *thread_pool;
+    RedBlackNode *root;
+} BuildTask;
+
+typedef struct {
+    RedBlackBST *tree;
+    void **items;
+    RedBlackNode **nodes;
+    size_t n;
+    RedBlackThreadPool *thread_pool;
+} FillTask;
+
+typedef struct {
+    RedBlackBST *tree;
+    SubTree node;
+    SubTree other;
+    SubTree joined;
+    size_t dup_num;
+    RedBlackNode **dups;
+    RedBlackThreadPool *thread_pool;
+} UnionTask;
+
+typedef struct {
+    RedBlackNode *node;
+    size_t start_rank;
+    size_t end_rank;
+    size_t left_rank;
+    MapFunc map_func;
+    ReduceFunc reduce_func;
+    const void *identity;
+    void *acc;
+    size_t acc_size;
+    RedBlackThreadPool *thread_pool;
+} MapTask;
+
+/* a tree being freed a bounded number of nodes at a time; an exclusive tree owns its slab pool outright,
+ * so its nodes only need their data freed before the slabs go in one piece */
+typedef struct {
+    RedBlackBST *tree;
+    bool exclusive;
+    RedBlackNode *stack[REDBLACK_MAX_HEIGHT * 2];
+    int depth;
+} Teardown;
+
+struct redblack_reclaimer {
+    /* detached trees wait here, linked through next_released, which only snapshots use otherwise */
+    RedBlackBST *head;
+    RedBlackBST *tail;
+    Teardown teardown;
+    bool tearing_down;
+    bool background;
+    bool stopping;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
 };
 
+typedef struct node_pool {
+    size_t slab_node_num;
+    size_t node_size;
+    NodeSlab *slabs;
+    size_t slab_used_num;
+    RedBlackNode *free_list;
+    size_t slab_num;
+    size_t live_node_num;
+    size_t free_node_num;
+    size_t ref_num;
+    IdIndex shared_data;
+    RedBlackBST *released;
+    size_t tree_num;
+    bool draining;
+    bool orphaned;
+} NodePool;
+
 struct redblack_bst {
     RedBlackNode *root;
     size_t node_num;
+    NodePool *pool;
+    IdIndex id_index;
     CmpFunc cmp_func;
     UpdateFunc update_func;
     FreeFunc free_func;
     GetDrawStrFunc get_draw_str_func;
+    GetIdFunc get_id_func;
+    GetKeyFunc get_key_func;
+    CopyFunc copy_func;
+    AggregateFunc aggregate_func;
+    size_t aggregate_size;
+    RedBlackBTree *btree;
+    RedBlackCompact *compact;
+    bool read_only;
+    RedBlackBST *next_released;
+#ifdef REDBLACK_STATS
+    RedBlackStats stats;
+#endif
 };
 
 static bool is_red(RedBlackNode *node);
-static int get_sub_node_num(RedBlackNode *node);
-static RedBlackNode *rotate_left(RedBlackNode *node);
-static RedBlackNode *rotate_right(RedBlackNode *node);
-static void flip_colors(RedBlackNode *node);
-static RedBlackNode *new_node(void *data, Color color);
-static RedBlackNode *insert(RedBlackBST *tree, RedBlackNode *node, void *data);
+static uint64_t get_key(RedBlackBST *tree, void *data);
+static int compare(RedBlackBST *tree, void *data, uint64_t key, RedBlackNode *node);
+static size_t get_sub_node_num(RedBlackNode *node);
+static void *get_aggregate(RedBlackNode *node);
+static void update_node(RedBlackBST *tree, RedBlackNode *node);
+static void aggregate_all(RedBlackBST *tree, RedBlackNode *node);
+static bool aggregate_by_rank(RedBlackBST *tree, size_t start_rank, size_t end_rank, void *aggregate);
+static void *aggregate_edge(RedBlackBST *tree, RedBlackNode *node, size_t rank, bool suffix, uint64_t *buffers);
+static RedBlackNode *rotate_left(RedBlackBST *tree, RedBlackNode *node);
+static RedBlackNode *rotate_right(RedBlackBST *tree, RedBlackNode *node);
+static void flip_colors(RedBlackBST *tree, RedBlackNode *node);
+static RedBlackNode *own(RedBlackBST *tree, RedBlackNode *node);
+static void own_data(RedBlackBST *tree, RedBlackNode *node);
+static bool unshare_data(RedBlackBST *tree, void *data);
+static void release_data(RedBlackBST *tree, void *data);
+static RedBlackNode *new_node(RedBlackBST *tree, void *data, Color color);
+static RedBlackNode *insert(RedBlackBST *tree, RedBlackNode *root, void *data, RedBlackNode *reuse_node);
 static void *get(RedBlackBST *tree, RedBlackNode *node, void *data);
 static RedBlackNode *get_min(RedBlackNode *node);
 static RedBlackNode *get_max(RedBlackNode *node);
 static RedBlackNode *free_all_nodes(RedBlackBST *tree, RedBlackNode *node);
 static void traverse_tree(RedBlackBST *tree, RedBlackNode *node);
-static RedBlackNode *balance(RedBlackNode *node);
-static RedBlackNode *delete_min(RedBlackBST *tree, RedBlackNode *node);
-static RedBlackNode *move_red_from_right_to_left(RedBlackNode *node);
-static RedBlackNode *delete_max(RedBlackBST *tree, RedBlackNode *node);
-static RedBlackNode *move_red_from_left_to_right(RedBlackNode *node);
+static RedBlackNode *balance(RedBlackBST *tree, RedBlackNode *node);
+static RedBlackNode *rebalance(RedBlackBST *tree, RedBlackNode *node, bool *changed);
+static RedBlackNode *unwind(RedBlackBST *tree, RedBlackNode **path, bool *dirs, int depth, RedBlackNode *node);
+static RedBlackNode *delete_min(RedBlackBST *tree, RedBlackNode *root);
+static RedBlackNode *move_red_from_right_to_left(RedBlackBST *tree, RedBlackNode *node);
+static RedBlackNode *delete_max(RedBlackBST *tree, RedBlackNode *root);
+static RedBlackNode *move_red_from_left_to_right(RedBlackBST *tree, RedBlackNode *node);
 static void free_one_node(RedBlackBST *tree, RedBlackNode *node);
-static RedBlackNode *delete(RedBlackBST *tree, RedBlackNode *node, void *data);
+static NodePool *pool_new(size_t slab_node_num);
+static void pool_unref(NodePool *pool);
+static void release_snapshot(RedBlackBST *snapshot);
+static void collect_released(NodePool *pool);
+static void drain_released(NodePool *pool);
+static RedBlackNode *pool_alloc(NodePool *pool);
+static RedBlackNode *pool_node_at(NodePool *pool, RedBlackNode *nodes, size_t i);
+static RedBlackNode *pool_alloc_block(NodePool *pool, size_t node_num);
+static void pool_release(NodePool *pool, RedBlackNode *node);
+static void pool_merge(NodePool *pool, NodePool *other);
+static void pool_destroy(NodePool *pool);
+static RedBlackNode *delete(RedBlackBST *tree, RedBlackNode *root, void *data,
+    RedBlackNode **removed, void *new_data);
+static bool fits_between(RedBlackBST *tree, RedBlackNode *node,
+    RedBlackNode *lower, RedBlackNode *upper, void *data);
+static RedBlackNode *detach(RedBlackBST *tree, void *data, void *new_data);
+static void remove_node(RedBlackBST *tree, RedBlackNode *node, void **removed_data);
+static uint64_t hash_id(uint64_t id);
+static IdEntry *index_find(IdIndex *index, uint64_t id);
+static void index_set(IdIndex *index, uint64_t id, void *data);
+static void index_erase(IdIndex *index, IdEntry *entry);
+static void index_put(RedBlackBST *tree, void *data);
+static void index_remove(RedBlackBST *tree, void *data);
+static void index_resize(IdIndex *index, size_t capacity);
+static void index_all(RedBlackBST *tree, RedBlackNode *node);
 static RedBlackNode *get_by_rank(RedBlackNode *node, size_t rank);
+static bool update_key(RedBlackBST *tree, void *data);
+static void upsert(RedBlackBST *tree, void *data);
+static void upsert_merge(RedBlackBST *tree, void **sorted, size_t n);
+static size_t collect_extremes(RedBlackNode *node, size_t n, void **items, bool from_max);
+static size_t pop_extremes(RedBlackBST *tree, size_t n, void **items, bool from_max);
+static size_t delete_range(RedBlackBST *tree, size_t start_rank, size_t end_rank);
+static void unindex_nodes(RedBlackBST *tree, RedBlackNode *node);
+static size_t take_nodes(RedBlackBST *tree, RedBlackNode *node, bool shared, void **items, size_t item_num,
+    bool from_max);
+static SubTree sub_tree(RedBlackNode *node);
+static SubTree make_root(RedBlackBST *tree, RedBlackNode *node, int parent_height);
+static SubTree join(RedBlackBST *tree, SubTree left, RedBlackNode *pivot, SubTree right);
+static void split_by_rank(RedBlackBST *tree, SubTree node, size_t rank, SubTree *left, SubTree *right);
+static void split_by_key(RedBlackBST *tree, SubTree node, void *data, uint64_t key,
+    SubTree *left, SubTree *right, RedBlackNode **equal);
+static SubTree union_nodes(RedBlackBST *tree, SubTree node, SubTree other, size_t *dup_num,
+    RedBlackNode **dups, RedBlackThreadPool *thread_pool);
+static void union_task(void *arg);
+static void union_trees(RedBlackBST *tree, RedBlackBST *other, RedBlackThreadPool *thread_pool);
+static bool is_unshared(NodePool *pool);
+static bool is_exclusive(NodePool *pool);
+static void keep_data(void *data);
+static void teardown_begin(Teardown *teardown, RedBlackBST *tree);
+static bool teardown_run(Teardown *teardown, size_t *budget);
+static RedBlackBST *reclaimer_pop(RedBlackReclaimer *reclaimer);
+static void *reclaimer_main(void *arg);
+static bool uses_backend(RedBlackBST *tree);
+static void backend_free(RedBlackBST *tree);
+static bool backend_insert(RedBlackBST *tree, void *data);
+static bool backend_remove(RedBlackBST *tree, void *data, void **removed_data);
+static void *backend_get(RedBlackBST *tree, void *data);
+static void *backend_get_by_rank(RedBlackBST *tree, size_t rank);
+static size_t backend_count_less(RedBlackBST *tree, void *data, bool *found);
+static size_t backend_count_by_score(RedBlackBST *tree, void *data, CmpScoreFunc cmp_score_func, bool inclusive);
+static void backend_get_range_by_rank(RedBlackBST *tree, size_t start_rank, size_t end_rank,
+    TraverseRangeFunc func);
+static size_t backend_get_extremes(RedBlackBST *tree, size_t n, void **items, bool from_max);
+static void adopt_pool(RedBlackBST *tree, RedBlackBST *other);
+static RedBlackNode *relocate(RedBlackBST *tree, NodePool *pool, RedBlackNode *node);
+static void merge_index(RedBlackBST *tree, RedBlackBST *other);
+static void move_index(RedBlackBST *from, RedBlackBST *to, RedBlackNode *node);
+static void release_tree(RedBlackBST *tree);
+static bool remove_data(RedBlackBST *tree, void *data, void **removed_data);
+static size_t get_height(RedBlackNode *node);
+#ifdef REDBLACK_STATS
+static uint64_t stats_now(void);
+static void stats_record(RedBlackBST *tree, RedBlackOp op, uint64_t start_ns);
+#endif
+static RedBlackNode *build(RedBlackNode **nodes, size_t n, int black_height, const size_t *max_num);
+static RedBlackNode *build_parallel(RedBlackNode **nodes, size_t n, int black_height, const size_t *max_num,
+    RedBlackThreadPool *thread_pool);
+static void build_task(void *arg);
+static void build_pair_task(void *arg);
+static void build_tasks(BuildTask *tasks, int task_num);
+static RedBlackNode *build_from_nodes(RedBlackNode **nodes, size_t n, RedBlackThreadPool *thread_pool);
+static void build_sorted(RedBlackBST *tree, void **items, size_t n, RedBlackThreadPool *thread_pool);
+static void build_sorted_task(void *arg);
+static void fill_task(void *arg);
+static size_t flatten(RedBlackBST *tree, RedBlackNode **nodes);
+static void sort_items(RedBlackBST *tree, void **items, void **buffer, size_t n);
+static size_t count_less(RedBlackBST *tree, RedBlackNode *node, void *data, bool *found);
+static size_t count_by_score(RedBlackNode *node, void *data, CmpScoreFunc cmp_score_func, bool inclusive);
+static void count_less_many(RedBlackNode *node, void **boundaries, size_t k, CmpScoreFunc cmp_score_func,
+    size_t less_num, size_t *less_nums);
 static void get_range_by_score(RedBlackNode *node, void *min_data, void *max_data,
     TraverseRangeFunc func, CmpScoreFunc cmp_score_func);
 static void get_range_by_rank(RedBlackNode *node, size_t start_rank, size_t end_rank, size_t left_rank,
         TraverseRangeFunc func);
+static void map_range(RedBlackNode *node, size_t start_rank, size_t end_rank, size_t left_rank,
+    MapFunc map_func, void *acc);
+static void map_task(void *arg);
 
 RedBlackBST *
 redblack_new(CmpFunc cmp_func, UpdateFunc update_func,
         FreeFunc free_func, GetDrawStrFunc get_draw_str_func) {
+    return redblack_new_with_pool(cmp_func, update_func, free_func, get_draw_str_func, 0);
+}
+
+RedBlackBST *
+redblack_new_with_pool(CmpFunc cmp_func, UpdateFunc update_func,
+        FreeFunc free_func, GetDrawStrFunc get_draw_str_func, size_t slab_node_num) {
     RedBlackBST *tree = malloc(sizeof(*tree));
     tree->root = NULL;
+    tree->node_num = 0;
+    tree->pool = pool_new(slab_node_num);
+    tree->id_index.entries = NULL;
+    tree->id_index.capacity = 0;
+    tree->id_index.entry_num = 0;
     tree->cmp_func = cmp_func;
     tree->update_func = update_func;
-    tree->free_func = free_func;
+    tree->free_func = free_func ? free_func : keep_data;
     tree->get_draw_str_func = get_draw_str_func;
+    tree->get_id_func = NULL;
+    tree->get_key_func = NULL;
+    tree->copy_func = NULL;
+    tree->aggregate_func = NULL;
+    tree->aggregate_size = 0;
+    tree->btree = NULL;
+    tree->compact = NULL;
+    tree->read_only = false;
+    tree->next_released = NULL;
+#ifdef REDBLACK_STATS
+    memset(&tree->stats, 0, sizeof(tree->stats));
+#endif
+    return tree;
+}
+
+RedBlackBST *
+redblack_new_btree(CmpFunc cmp_func, UpdateFunc update_func,
+        FreeFunc free_func, GetKeyFunc get_key_func) {
+    RedBlackBST *tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    tree->get_key_func = get_key_func;
+    tree->btree = redblack_btree_new(cmp_func, update_func, tree->free_func, get_key_func);
+    return tree;
+}
+
+RedBlackBST *
+redblack_new_compact(CmpFunc cmp_func, UpdateFunc update_func, FreeFunc free_func) {
+    RedBlackBST *tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    tree->compact = redblack_compact_new(cmp_func, update_func, tree->free_func);
     return tree;
 }
 
+RedBlackBST *
+redblack_snapshot(RedBlackBST *tree) {
+    assert(!uses_backend(tree) && tree->copy_func);
+    collect_released(tree->pool);
+    RedBlackBST *snapshot = malloc(sizeof(*snapshot));
+    *snapshot = *tree;
+    if(snapshot->root)
+        snapshot->root->ref_num++;
+    __atomic_add_fetch(&snapshot->pool->ref_num, 1, __ATOMIC_RELAXED);
+    snapshot->id_index.entries = NULL;
+    snapshot->id_index.capacity = 0;
+    snapshot->id_index.entry_num = 0;
+    snapshot->get_id_func = NULL;
+    snapshot->read_only = true;
+#ifdef REDBLACK_STATS
+    memset(&snapshot->stats, 0, sizeof(snapshot->stats));
+#endif
+    return snapshot;
+}
+
+void
+redblack_set_copy_func(RedBlackBST *tree, CopyFunc copy_func) {
+    tree->copy_func = copy_func;
+}
+
 void
 redblack_free(RedBlackBST *tree) {
-    tree->root = free_all_nodes(tree, tree->root);
-    free(tree);
+    if(tree->read_only) {
+        release_snapshot(tree);
+        return;
+    }
+    collect_released(tree->pool);
+    Teardown teardown;
+    size_t budget = SIZE_MAX;
+    teardown_begin(&teardown, tree);
+    teardown_run(&teardown, &budget);
+}
+
+RedBlackReclaimer *
+redblack_reclaimer_new(bool background) {
+    RedBlackReclaimer *reclaimer = malloc(sizeof(*reclaimer));
+    reclaimer->head = NULL;
+    reclaimer->tail = NULL;
+    reclaimer->tearing_down = false;
+    reclaimer->background = background;
+    reclaimer->stopping = false;
+    pthread_mutex_init(&reclaimer->lock, NULL);
+    pthread_cond_init(&reclaimer->cond, NULL);
+    if(background)
+        pthread_create(&reclaimer->thread, NULL, reclaimer_main, reclaimer);
+    return reclaimer;
+}
+
+void
+redblack_reclaimer_free(RedBlackReclaimer *reclaimer) {
+    if(reclaimer->background) {
+        pthread_mutex_lock(&reclaimer->lock);
+        reclaimer->stopping = true;
+        pthread_cond_signal(&reclaimer->cond);
+        pthread_mutex_unlock(&reclaimer->lock);
+        pthread_join(reclaimer->thread, NULL);
+    }
+    else {
+        while(redblack_reclaim(reclaimer, SIZE_MAX))
+            ;
+    }
+    pthread_cond_destroy(&reclaimer->cond);
+    pthread_mutex_destroy(&reclaimer->lock);
+    free(reclaimer);
+}
+
+void
+redblack_free_deferred(RedBlackReclaimer *reclaimer, RedBlackBST *tree) {
+    if(tree->read_only) {
+        release_snapshot(tree);
+        return;
+    }
+    collect_released(tree->pool);
+    if(reclaimer->background && __atomic_load_n(&tree->pool->ref_num, __ATOMIC_ACQUIRE) > 1) {
+        redblack_free(tree);
+        return;
+    }
+    tree->next_released = NULL;
+    pthread_mutex_lock(&reclaimer->lock);
+    if(reclaimer->tail)
+        reclaimer->tail->next_released = tree;
+    else
+        reclaimer->head = tree;
+    reclaimer->tail = tree;
+    pthread_cond_signal(&reclaimer->cond);
+    pthread_mutex_unlock(&reclaimer->lock);
+}
+
+bool
+redblack_reclaim(RedBlackReclaimer *reclaimer, size_t max_node_num) {
+    assert(!reclaimer->background);
+    for(;;) {
+        if(!reclaimer->tearing_down) {
+            RedBlackBST *tree = reclaimer_pop(reclaimer);
+            if(tree == NULL)
+                return false;
+            teardown_begin(&reclaimer->teardown, tree);
+            reclaimer->tearing_down = true;
+        }
+        if(!teardown_run(&reclaimer->teardown, &max_node_num))
+            return true;
+        reclaimer->tearing_down = false;
+    }
+}
+
+void
+redblack_get_pool_stats(RedBlackBST *tree, RedBlackPoolStats *stats) {
+    stats->slab_num = tree->pool->slab_num;
+    stats->live_node_num = tree->pool->live_node_num;
+    stats->free_node_num = tree->pool->free_node_num;
+}
+
+void
+redblack_get_stats(RedBlackBST *tree, RedBlackStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+#ifdef REDBLACK_STATS
+    stats->cmp_num = __atomic_load_n(&tree->stats.cmp_num, __ATOMIC_RELAXED);
+    stats->rotate_left_num = __atomic_load_n(&tree->stats.rotate_left_num, __ATOMIC_RELAXED);
+    stats->rotate_right_num = __atomic_load_n(&tree->stats.rotate_right_num, __ATOMIC_RELAXED);
+    stats->flip_num = __atomic_load_n(&tree->stats.flip_num, __ATOMIC_RELAXED);
+    stats->alloc_num = __atomic_load_n(&tree->stats.alloc_num, __ATOMIC_RELAXED);
+    for(int op = 0;op < REDBLACK_OP_NUM;op++) {
+        for(int i = 0;i < REDBLACK_STATS_BUCKET_NUM;i++)
+            stats->latency[op][i] = __atomic_load_n(&tree->stats.latency[op][i], __ATOMIC_RELAXED);
+    }
+#endif
+    for(RedBlackNode *node = tree->root;node;node = node->left)
+        stats->black_height += !is_red(node);
+    stats->max_height = stats->black_height * 2;
+}
+
+size_t
+redblack_get_height(RedBlackBST *tree) {
+    return get_height(tree->root);
+}
+
+void
+redblack_reset_stats(RedBlackBST *tree) {
+#ifdef REDBLACK_STATS
+    __atomic_store_n(&tree->stats.cmp_num, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&tree->stats.rotate_left_num, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&tree->stats.rotate_right_num, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&tree->stats.flip_num, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&tree->stats.alloc_num, 0, __ATOMIC_RELAXED);
+    for(int op = 0;op < REDBLACK_OP_NUM;op++) {
+        for(int i = 0;i < REDBLACK_STATS_BUCKET_NUM;i++)
+            __atomic_store_n(&tree->stats.latency[op][i], 0, __ATOMIC_RELAXED);
+    }
+#endif
+}
+
+void
+redblack_set_id_func(RedBlackBST *tree, GetIdFunc get_id_func) {
+    assert(!tree->read_only);
+    free(tree->id_index.entries);
+    tree->id_index.entries = NULL;
+    tree->id_index.capacity = 0;
+    tree->id_index.entry_num = 0;
+    tree->get_id_func = get_id_func;
+    if(get_id_func && uses_backend(tree)) {
+        for(size_t rank = 1;rank <= tree->node_num;rank++)
+            index_put(tree, backend_get_by_rank(tree, rank));
+    }
+    else if(get_id_func)
+        index_all(tree, tree->root);
+}
+
+void
+redblack_set_key_func(RedBlackBST *tree, GetKeyFunc get_key_func) {
+    assert(!tree->read_only && !uses_backend(tree) && redblack_is_empty(tree));
+    tree->get_key_func = get_key_func;
+}
+
+void
+redblack_set_aggregate_func(RedBlackBST *tree, AggregateFunc aggregate_func, size_t aggregate_size) {
+    NodePool *pool = tree->pool;
+    assert(!tree->read_only && !uses_backend(tree) && aggregate_size > 0);
+    assert(pool->tree_num == 1 && pool->live_node_num == 0 && pool->slab_num == 0);
+    tree->aggregate_func = aggregate_func;
+    tree->aggregate_size = aggregate_size;
+    /* the aggregate follows the node, padded so that the nodes of a slab stay aligned */
+    pool->node_size = sizeof(RedBlackNode) + (aggregate_size + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+}
+
+void *
+redblack_get_by_id(RedBlackBST *tree, uint64_t id) {
+    assert(tree->get_id_func);
+    IdEntry *entry = index_find(&tree->id_index, id);
+    return entry ? entry->data : NULL;
+}
+
+bool
+redblack_update_key(RedBlackBST *tree, void *data) {
+    assert(!tree->read_only && tree->get_id_func);
+    STATS_BEGIN();
+    collect_released(tree->pool);
+    bool updated = update_key(tree, data);
+    STATS_END(tree, REDBLACK_OP_UPDATE);
+    return updated;
 }
 
 void
 redblack_insert(RedBlackBST *tree, void *data) {
-    tree->root = insert(tree, tree->root, data);
-    tree->root->color = BLACK;
+    assert(!tree->read_only);
+    STATS_BEGIN();
+    collect_released(tree->pool);
+    if(uses_backend(tree)) {
+        if(backend_insert(tree, data)) {
+            tree->node_num++;
+            if(tree->get_id_func)
+                index_put(tree, data);
+        }
+    }
+    else {
+        tree->root = insert(tree, tree->root, data, NULL);
+        tree->root->color = BLACK;
+    }
+    STATS_END(tree, REDBLACK_OP_INSERT);
+}
+
+void
+redblack_build_sorted(RedBlackBST *tree, void **items, size_t n) {
+    assert(!tree->read_only && redblack_is_empty(tree));
+    collect_released(tree->pool);
+    if(uses_backend(tree)) {
+        for(size_t i = 0;i < n;i++)
+            redblack_insert(tree, items[i]);
+        return;
+    }
+    build_sorted(tree, items, n, NULL);
+}
+
+void
+redblack_insert_batch(RedBlackBST *tree, void **items, size_t n) {
+    assert(!tree->read_only);
+    collect_released(tree->pool);
+    if(n == 0)
+        return;
+    void **sorted = malloc(2 * n * sizeof(*sorted));
+    memcpy(sorted, items, n * sizeof(*sorted));
+    sort_items(tree, sorted, sorted + n, n);
+
+    size_t log_num = 1;
+    while(((size_t)1 << log_num) <= tree->node_num + n)
+        log_num++;
+    if(uses_backend(tree) || n * log_num < tree->node_num) {
+        for(size_t i = 0;i < n;i++)
+            redblack_insert(tree, sorted[i]);
+        free(sorted);
+        return;
+    }
+
+    RedBlackNode **old_nodes = malloc(tree->node_num * sizeof(*old_nodes));
+    size_t old_num = flatten(tree, old_nodes);
+    RedBlackNode **nodes = malloc((old_num + n) * sizeof(*nodes));
+    size_t node_num = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while(j < n) {
+        uint64_t key = get_key(tree, sorted[j]);
+        int result = i < old_num ? compare(tree, sorted[j], key, old_nodes[i]) : -1;
+        if(result > 0) {
+            nodes[node_num++] = old_nodes[i++];
+            continue;
+        }
+        if(result == 0 || (node_num > 0 && compare(tree, sorted[j], key, nodes[node_num - 1]) == 0)) {
+            RedBlackNode *node = result == 0 ? old_nodes[i] : nodes[node_num - 1];
+            own_data(tree, node);
+            tree->update_func(node->data, sorted[j++]);
+            node->key = get_key(tree, node->data);
+            continue;
+        }
+        RedBlackNode *node = pool_alloc(tree->pool);
+        STATS_ADD(tree, alloc_num, 1);
+        node->key = key;
+        node->data = sorted[j++];
+        node->ref_num = 1;
+        nodes[node_num++] = node;
+        if(tree->get_id_func)
+            index_put(tree, node->data);
+    }
+    while(i < old_num)
+        nodes[node_num++] = old_nodes[i++];
+    tree->root = build_from_nodes(nodes, node_num, NULL);
+    aggregate_all(tree, tree->root);
+    tree->node_num = node_num;
+    free(nodes);
+    free(old_nodes);
+    free(sorted);
+}
+
+void
+redblack_upsert_batch(RedBlackBST *tree, void **items, size_t n) {
+    assert(!tree->read_only && tree->get_id_func);
+    if(n == 0)
+        return;
+    STATS_BEGIN();
+    collect_released(tree->pool);
+    void **sorted = malloc(2 * n * sizeof(*sorted));
+    memcpy(sorted, items, n * sizeof(*sorted));
+    sort_items(tree, sorted, sorted + n, n);
+    size_t log_num = 1;
+    while(((size_t)1 << log_num) <= tree->node_num + n)
+        log_num++;
+    if(uses_backend(tree) || n * log_num < tree->node_num) {
+        for(size_t i = 0;i < n;i++)
+            upsert(tree, sorted[i]);
+    }
+    else
+        upsert_merge(tree, sorted, n);
+    free(sorted);
+    STATS_END(tree, REDBLACK_OP_UPDATE);
 }
 
 void *
 redblack_get(RedBlackBST *tree, void *data) {
-    return get(tree, tree->root, data);
+    STATS_BEGIN();
+    void *found = uses_backend(tree) ? backend_get(tree, data) : get(tree, tree->root, data);
+    STATS_END(tree, REDBLACK_OP_GET);
+    return found;
 }
 
 void *
 redblack_get_min(RedBlackBST *tree) {
+    if(uses_backend(tree))
+        return redblack_get_by_rank(tree, 1);
     assert(tree->root);
     return get_min(tree->root)->data;
 }
 
 void *
 redblack_get_max(RedBlackBST *tree) {
+    if(uses_backend(tree))
+        return redblack_get_by_rank(tree, tree->node_num);
     assert(tree->root);
     return get_max(tree->root)->data;
 }
 
 void
 redblack_delete_min(RedBlackBST *tree) {
+    assert(!tree->read_only);
+    collect_released(tree->pool);
     if(redblack_is_empty(tree))
         return;
+    if(uses_backend(tree)) {
+        redblack_delete(tree, redblack_get_min(tree));
+        return;
+    }
+    tree->root = own(tree, tree->root);
     if(!is_red(tree->root->left) && !is_red(tree->root->right))
         tree->root->color = RED;
     tree->root = delete_min(tree, tree->root);
@@ -100,8 +701,15 @@ redblack_delete_min(RedBlackBST *tree) {
 
 void
 redblack_delete_max(RedBlackBST *tree) {
+    assert(!tree->read_only);
+    collect_released(tree->pool);
     if(redblack_is_empty(tree))
         return;
+    if(uses_backend(tree)) {
+        redblack_delete(tree, redblack_get_max(tree));
+        return;
+    }
+    tree->root = own(tree, tree->root);
     if(!is_red(tree->root->left) && !is_red(tree->root->right))
         tree->root->color = RED;
     tree->root = delete_max(tree, tree->root);
@@ -109,26 +717,101 @@ redblack_delete_max(RedBlackBST *tree) {
         tree->root->color = BLACK;
 }
 
-void
+bool
 redblack_delete(RedBlackBST *tree, void *data) {
-    if(redblack_is_empty(tree))
-        return;
-    if(redblack_get(tree, data) == NULL)
-        return;
-    if(!is_red(tree->root->left) && !is_red(tree->root->right))
-        tree->root->color = RED;
-    tree->root = delete(tree, tree->root, data);
-    if(!redblack_is_empty(tree))
-        tree->root->color = BLACK;
+    return redblack_remove(tree, data, NULL);
+}
+
+bool
+redblack_remove(RedBlackBST *tree, void *data, void **removed_data) {
+    assert(!tree->read_only);
+    STATS_BEGIN();
+    collect_released(tree->pool);
+    bool removed = remove_data(tree, data, removed_data);
+    STATS_END(tree, REDBLACK_OP_DELETE);
+    return removed;
 }
 
 void *
 redblack_get_by_rank(RedBlackBST *tree, size_t rank) {
     assert(rank >= 1 && rank <= tree->node_num);
-    RedBlackNode *node = get_by_rank(tree->root, rank);
-    if(node == NULL)
+    STATS_BEGIN();
+    void *data = NULL;
+    if(uses_backend(tree))
+        data = backend_get_by_rank(tree, rank);
+    else {
+        RedBlackNode *node = get_by_rank(tree->root, rank);
+        if(node)
+            data = node->data;
+    }
+    STATS_END(tree, REDBLACK_OP_RANK);
+    return data;
+}
+
+size_t
+redblack_rank_of(RedBlackBST *tree, void *data) {
+    bool found = false;
+    STATS_BEGIN();
+    size_t less_num = uses_backend(tree) ? backend_count_less(tree, data, &found)
+        : count_less(tree, tree->root, data, &found);
+    STATS_END(tree, REDBLACK_OP_RANK);
+    return found ? less_num + 1 : 0;
+}
+
+size_t
+redblack_count_less(RedBlackBST *tree, void *data) {
+    bool found;
+    if(uses_backend(tree))
+        return backend_count_less(tree, data, &found);
+    return count_less(tree, tree->root, data, &found);
+}
+
+size_t
+redblack_count_less_by_score(RedBlackBST *tree, void *data, CmpScoreFunc cmp_score_func) {
+    if(uses_backend(tree))
+        return backend_count_by_score(tree, data, cmp_score_func, false);
+    return count_by_score(tree->root, data, cmp_score_func, false);
+}
+
+size_t
+redblack_count_in_score_range(RedBlackBST *tree,
+        void *min_data, void *max_data, CmpScoreFunc cmp_score_func) {
+    if(uses_backend(tree)) {
+        size_t not_greater_num = backend_count_by_score(tree, max_data, cmp_score_func, true);
+        size_t less_num = backend_count_by_score(tree, min_data, cmp_score_func, false);
+        return not_greater_num > less_num ? not_greater_num - less_num : 0;
+    }
+    size_t not_greater_num = count_by_score(tree->root, max_data, cmp_score_func, true);
+    size_t less_num = count_by_score(tree->root, min_data, cmp_score_func, false);
+    return not_greater_num > less_num ? not_greater_num - less_num : 0;
+}
+
+void *
+redblack_quantile(RedBlackBST *tree, double q) {
+    if(tree->node_num == 0)
         return NULL;
-    return node->data;
+    double rank = q * tree->node_num;
+    size_t ceil_rank = rank <= 1 ? 1 : rank >= tree->node_num ? tree->node_num : (size_t)rank;
+    if(ceil_rank < rank)
+        ceil_rank++;
+    return redblack_get_by_rank(tree, ceil_rank);
+}
+
+void
+redblack_histogram(RedBlackBST *tree, void **boundaries, size_t k,
+        CmpScoreFunc cmp_score_func, size_t *counts) {
+    STATS_BEGIN();
+    if(uses_backend(tree)) {
+        for(size_t i = 0;i < k;i++)
+            counts[i] = backend_count_by_score(tree, boundaries[i], cmp_score_func, false);
+    }
+    else
+        count_less_many(tree->root, boundaries, k, cmp_score_func, 0, counts);
+    /* counts holds the number of items below each boundary until turned into bucket sizes */
+    counts[k] = tree->node_num;
+    for(size_t i = k;i > 0;i--)
+        counts[i] -= counts[i - 1];
+    STATS_END(tree, REDBLACK_OP_RANGE);
 }
 
 void
@@ -136,203 +819,1531 @@ redblack_get_range_by_rank(RedBlackBST *tree,
         size_t start_rank, size_t end_rank, TraverseRangeFunc func) {
     assert(start_rank >= 1 && start_rank <= tree->node_num);
     assert(end_rank >= 1 && end_rank <= tree->node_num);
-    get_range_by_rank(tree->root, start_rank, end_rank, 0, func);
+    STATS_BEGIN();
+    if(uses_backend(tree))
+        backend_get_range_by_rank(tree, start_rank, end_rank, func);
+    else
+        get_range_by_rank(tree->root, start_rank, end_rank, 0, func);
+    STATS_END(tree, REDBLACK_OP_RANGE);
 }
 
 void
 redblack_get_range_by_score(RedBlackBST *tree,
         void *min_data, void *max_data,
         TraverseRangeFunc traverse_func, CmpScoreFunc cmp_score_func) {
-    get_range_by_score(tree->root, min_data, max_data, traverse_func, cmp_score_func);
+    STATS_BEGIN();
+    if(uses_backend(tree)) {
+        size_t start_rank = backend_count_by_score(tree, min_data, cmp_score_func, false) + 1;
+        size_t end_rank = backend_count_by_score(tree, max_data, cmp_score_func, true);
+        backend_get_range_by_rank(tree, start_rank, end_rank, traverse_func);
+    }
+    else
+        get_range_by_score(tree->root, min_data, max_data, traverse_func, cmp_score_func);
+    STATS_END(tree, REDBLACK_OP_RANGE);
 }
 
-void
-redblack_traverse(RedBlackBST *tree) {
-    traverse_tree(tree, tree->root);
+bool
+redblack_aggregate_by_rank(RedBlackBST *tree, size_t start_rank, size_t end_rank, void *aggregate) {
+    assert(tree->aggregate_func);
+    STATS_BEGIN();
+    bool found = aggregate_by_rank(tree, start_rank, end_rank, aggregate);
+    STATS_END(tree, REDBLACK_OP_RANGE);
+    return found;
 }
 
 bool
-redblack_is_empty(RedBlackBST *tree) {
-    return tree->root == NULL;
+redblack_aggregate_by_score(RedBlackBST *tree, void *min_data, void *max_data,
+        CmpScoreFunc cmp_score_func, void *aggregate) {
+    assert(tree->aggregate_func);
+    STATS_BEGIN();
+    size_t start_rank = count_by_score(tree->root, min_data, cmp_score_func, false) + 1;
+    size_t end_rank = count_by_score(tree->root, max_data, cmp_score_func, true);
+    bool found = aggregate_by_rank(tree, start_rank, end_rank, aggregate);
+    STATS_END(tree, REDBLACK_OP_RANGE);
+    return found;
 }
 
-RedBlackNode *
-redblack_get_root(RedBlackBST *tree) {
-    return tree->root;
+size_t
+redblack_top_n(RedBlackBST *tree, size_t n, void **items) {
+    STATS_BEGIN();
+    if(n > tree->node_num)
+        n = tree->node_num;
+    if(uses_backend(tree))
+        n = backend_get_extremes(tree, n, items, true);
+    else
+        n = collect_extremes(tree->root, n, items, true);
+    STATS_END(tree, REDBLACK_OP_RANGE);
+    return n;
 }
 
-RedBlackNode *
-redblack_get_left(RedBlackNode *node) {
-    return node->left;
+size_t
+redblack_bottom_n(RedBlackBST *tree, size_t n, void **items) {
+    STATS_BEGIN();
+    if(n > tree->node_num)
+        n = tree->node_num;
+    if(uses_backend(tree))
+        n = backend_get_extremes(tree, n, items, false);
+    else
+        n = collect_extremes(tree->root, n, items, false);
+    STATS_END(tree, REDBLACK_OP_RANGE);
+    return n;
 }
 
-RedBlackNode *
-redblack_get_right(RedBlackNode *node) {
-    return node->right;
+size_t
+redblack_pop_max_n(RedBlackBST *tree, size_t n, void **items) {
+    assert(!tree->read_only);
+    STATS_BEGIN();
+    collect_released(tree->pool);
+    n = pop_extremes(tree, n, items, true);
+    STATS_END(tree, REDBLACK_OP_DELETE);
+    return n;
 }
 
-void *
-redblack_get_data(RedBlackNode *node) {
-    return node->data;
+size_t
+redblack_pop_min_n(RedBlackBST *tree, size_t n, void **items) {
+    assert(!tree->read_only);
+    STATS_BEGIN();
+    collect_released(tree->pool);
+    n = pop_extremes(tree, n, items, false);
+    STATS_END(tree, REDBLACK_OP_DELETE);
+    return n;
 }
 
-const char *
-redblack_get_draw_str(RedBlackBST *tree, RedBlackNode *node) {
-    return tree->get_draw_str_func(node);
+size_t
+redblack_delete_range_by_rank(RedBlackBST *tree, size_t start_rank, size_t end_rank) {
+    assert(!tree->read_only);
+    STATS_BEGIN();
+    collect_released(tree->pool);
+    size_t removed_num = delete_range(tree, start_rank, end_rank);
+    STATS_END(tree, REDBLACK_OP_DELETE);
+    return removed_num;
 }
 
 size_t
-redblack_get_sub_node_num(RedBlackNode *node) {
-    return get_sub_node_num(node);
+redblack_delete_range_by_score(RedBlackBST *tree, void *min_data, void *max_data,
+        CmpScoreFunc cmp_score_func) {
+    assert(!tree->read_only);
+    STATS_BEGIN();
+    collect_released(tree->pool);
+    size_t start_rank, end_rank;
+    if(uses_backend(tree)) {
+        start_rank = backend_count_by_score(tree, min_data, cmp_score_func, false) + 1;
+        end_rank = backend_count_by_score(tree, max_data, cmp_score_func, true);
+    }
+    else {
+        start_rank = count_by_score(tree->root, min_data, cmp_score_func, false) + 1;
+        end_rank = count_by_score(tree->root, max_data, cmp_score_func, true);
+    }
+    size_t removed_num = delete_range(tree, start_rank, end_rank);
+    STATS_END(tree, REDBLACK_OP_DELETE);
+    return removed_num;
 }
 
-bool
-redblack_is_red(RedBlackNode *node) {
-    return is_red(node);
+void
+redblack_split(RedBlackBST *tree, void *data, RedBlackBST **left, RedBlackBST **right) {
+    assert(!tree->read_only && !uses_backend(tree));
+    collect_released(tree->pool);
+    RedBlackBST *new_tree = malloc(sizeof(*new_tree));
+    *new_tree = *tree;
+    new_tree->id_index.entries = NULL;
+    new_tree->id_index.capacity = 0;
+    new_tree->id_index.entry_num = 0;
+#ifdef REDBLACK_STATS
+    memset(&new_tree->stats, 0, sizeof(new_tree->stats));
+#endif
+    __atomic_add_fetch(&tree->pool->ref_num, 1, __ATOMIC_RELAXED);
+    tree->pool->tree_num++;
+    SubTree left_tree, right_tree;
+    split_by_key(tree, sub_tree(tree->root), data, get_key(tree, data), &left_tree, &right_tree, NULL);
+    tree->root = left_tree.root;
+    new_tree->root = right_tree.root;
+    tree->node_num = get_sub_node_num(tree->root);
+    new_tree->node_num = get_sub_node_num(new_tree->root);
+    if(tree->get_id_func) {
+        if(tree->node_num < new_tree->node_num) {
+            new_tree->id_index = tree->id_index;
+            tree->id_index.entries = NULL;
+            tree->id_index.capacity = 0;
+            tree->id_index.entry_num = 0;
+            move_index(new_tree, tree, tree->root);
+        }
+        else
+            move_index(tree, new_tree, new_tree->root);
+    }
+    *left = tree;
+    *right = new_tree;
 }
 
-static void
-get_range_by_rank(RedBlackNode *node, size_t start_rank, size_t end_rank, size_t left_rank, TraverseRangeFunc func) {
-    if(node == NULL)
-        return;
-    size_t node_rank = get_sub_node_num(node->left) + 1 + left_rank;
-    if(node_rank > start_rank)
-        get_range_by_rank(node->left, start_rank, end_rank, left_rank, func);
-    if(node_rank >= start_rank && node_rank <= end_rank)
-        func(node->data);
-    if(node_rank < end_rank)
-        get_range_by_rank(node->right, start_rank, end_rank, node_rank, func);
+void
+redblack_join(RedBlackBST *left, RedBlackBST *right) {
+    assert(!left->read_only && !right->read_only && !uses_backend(left) && !uses_backend(right));
+    assert(left->cmp_func == right->cmp_func && left->get_key_func == right->get_key_func);
+    assert(left->get_id_func == right->get_id_func && left->aggregate_func == right->aggregate_func);
+    collect_released(left->pool);
+    adopt_pool(left, right);
+    if(left->root == NULL)
+        left->root = right->root;
+    else if(right->root) {
+        assert(left->cmp_func(get_max(left->root)->data, get_min(right->root)->data) < 0);
+        SubTree pivot, rest;
+        split_by_rank(left, sub_tree(right->root), 1, &pivot, &rest);
+        left->root = join(left, sub_tree(left->root), pivot.root, rest).root;
+    }
+    left->node_num += right->node_num;
+    merge_index(left, right);
+    release_tree(right);
 }
 
-static void
-get_range_by_score(RedBlackNode *node,
-        void *min_data, void *max_data,
-        TraverseRangeFunc traverse_func, CmpScoreFunc cmp_score_func) {
-    if(node == NULL)
-        return;
-    int result_min = cmp_score_func(node->data, min_data);
-    int result_max = cmp_score_func(node->data, max_data);
-    if(result_min >= 0)
-        get_range_by_score(node->left, min_data, max_data, traverse_func, cmp_score_func);
-    if(result_min >= 0 && result_max <= 0)
-        traverse_func(node->data);
-    if(result_max <= 0)
-        get_range_by_score(node->right, min_data, max_data, traverse_func, cmp_score_func);
+void
+redblack_union(RedBlackBST *tree, RedBlackBST *other) {
+    union_trees(tree, other, NULL);
 }
 
-static RedBlackNode *
-get_by_rank(RedBlackNode *node, size_t rank) {
-    if(node == NULL)
-        return NULL;
-    size_t left_num = get_sub_node_num(node->left);
-    if(rank < left_num + 1)
-        return get_by_rank(node->left, rank);
-    else if(rank > left_num + 1)
-        return get_by_rank(node->right, rank - left_num - 1);
-    else
-        return node;
+void
+redblack_build_sorted_parallel(RedBlackBST *tree, void **items, size_t n, RedBlackThreadPool *thread_pool) {
+    assert(!tree->read_only && redblack_is_empty(tree));
+    if(thread_pool == NULL || uses_backend(tree)) {
+        redblack_build_sorted(tree, items, n);
+        return;
+    }
+    collect_released(tree->pool);
+    FillTask task = {tree, items, NULL, n, thread_pool};
+    redblack_thread_pool_run(thread_pool, build_sorted_task, &task);
 }
 
-static RedBlackNode *
-delete(RedBlackBST *tree, RedBlackNode *node, void *data) {
-    int result = tree->cmp_func(data, node->data);
-    if(result < 0) {
-        if(!is_red(node->left) && !is_red(node->left->left))
-            node = move_red_from_right_to_left(node);
-        RedBlackNode *old_left = node->left;
-        node->left = delete(tree, node->left, data);
-        if(node->left == NULL && old_left) {
-            tree->node_num--;
-            free_one_node(tree, old_left);
-        }
+void
+redblack_union_parallel(RedBlackBST *tree, RedBlackBST **others, size_t other_num,
+        RedBlackThreadPool *thread_pool) {
+    /* unions neighbours pairwise so that both sides of a union stay about the same size */
+    size_t tree_num = other_num + 1;
+    RedBlackBST **trees = malloc(tree_num * sizeof(*trees));
+    trees[0] = tree;
+    memcpy(trees + 1, others, other_num * sizeof(*trees));
+    for(size_t step = 1;step < tree_num;step *= 2) {
+        for(size_t i = 0;i + step < tree_num;i += 2 * step)
+            union_trees(trees[i], trees[i + step], thread_pool);
     }
+    free(trees);
+}
+
+void
+redblack_map_range(RedBlackBST *tree, size_t start_rank, size_t end_rank,
+        MapFunc map_func, ReduceFunc reduce_func, void *acc, size_t acc_size, RedBlackThreadPool *thread_pool) {
+    assert(!uses_backend(tree));
+    assert(start_rank >= 1 && start_rank <= tree->node_num);
+    assert(end_rank >= 1 && end_rank <= tree->node_num);
+    STATS_BEGIN();
+    if(thread_pool == NULL || end_rank - start_rank < PARALLEL_GRAIN)
+        map_range(tree->root, start_rank, end_rank, 0, map_func, acc);
     else {
-        if(is_red(node->left))
-            node = rotate_right(node);
-        if(result == 0 && node->right == NULL)
-            return NULL;
-        if(!is_red(node->right) && !is_red(node->right->left))
-            node = move_red_from_left_to_right(node);
-        if(result == 0) {
-            RedBlackNode *min_node = get_min(node->right);
-            tree->update_func(node->data, min_node->data);
-            node->right = delete_min(tree, node->right);
-        }
-        else {
-            RedBlackNode *old_right = node->right;
-            node->right = delete(tree, node->right, data);
-            if(node->right == NULL && old_right) {
-                tree->node_num--;
-                free_one_node(tree, old_right);
-            }
-        }
+        void *identity = malloc(acc_size);
+        memcpy(identity, acc, acc_size);
+        MapTask task = {tree->root, start_rank, end_rank, 0, map_func, reduce_func,
+            identity, acc, acc_size, thread_pool};
+        redblack_thread_pool_run(thread_pool, map_task, &task);
+        free(identity);
     }
-    return balance(node);
+    STATS_END(tree, REDBLACK_OP_RANGE);
 }
 
-static RedBlackNode *
-delete_max(RedBlackBST *tree, RedBlackNode *node) {
-    if(is_red(node->left))
-        node = rotate_right(node);
-    if(node->right == NULL)
-        return NULL;
-    if(!is_red(node->right) && !is_red(node->right->left))
-        node = move_red_from_left_to_right(node);
-    RedBlackNode *old_right = node->right;
-    node->right = delete_max(tree, node->right);
-    if(node->right == NULL && old_right) {
-        tree->node_num--;
-        free_one_node(tree, old_right);
+void
+redblack_cursor_init(RedBlackCursor *cursor, RedBlackBST *tree) {
+    assert(!uses_backend(tree));
+    cursor->tree = tree;
+    cursor->depth = 0;
+    cursor->rank = 0;
+}
+
+bool
+redblack_cursor_seek_first(RedBlackCursor *cursor) {
+    cursor->depth = 0;
+    for(RedBlackNode *node = cursor->tree->root;node;node = node->left)
+        cursor->path[cursor->depth++] = node;
+    cursor->rank = 1;
+    return cursor->depth > 0;
+}
+
+bool
+redblack_cursor_seek_last(RedBlackCursor *cursor) {
+    cursor->depth = 0;
+    for(RedBlackNode *node = cursor->tree->root;node;node = node->right)
+        cursor->path[cursor->depth++] = node;
+    cursor->rank = cursor->tree->node_num;
+    return cursor->depth > 0;
+}
+
+bool
+redblack_cursor_seek(RedBlackCursor *cursor, void *data) {
+    RedBlackBST *tree = cursor->tree;
+    RedBlackNode *node = tree->root;
+    int depth = 0;
+    size_t less_num = 0;
+    uint64_t key = get_key(tree, data);
+    cursor->depth = 0;
+    while(node) {
+        cursor->path[depth++] = node;
+        int result = compare(tree, data, key, node);
+        if(result > 0) {
+            less_num += get_sub_node_num(node->left) + 1;
+            node = node->right;
+        }
+        else {
+            cursor->depth = depth;
+            cursor->rank = less_num + get_sub_node_num(node->left) + 1;
+            if(result == 0)
+                break;
+            node = node->left;
+        }
+    }
+    return cursor->depth > 0;
+}
+
+bool
+redblack_cursor_seek_by_score(RedBlackCursor *cursor, void *data, CmpScoreFunc cmp_score_func) {
+    RedBlackNode *node = cursor->tree->root;
+    int depth = 0;
+    size_t less_num = 0;
+    cursor->depth = 0;
+    while(node) {
+        cursor->path[depth++] = node;
+        if(cmp_score_func(node->data, data) < 0) {
+            less_num += get_sub_node_num(node->left) + 1;
+            node = node->right;
+        }
+        else {
+            cursor->depth = depth;
+            cursor->rank = less_num + get_sub_node_num(node->left) + 1;
+            node = node->left;
+        }
+    }
+    return cursor->depth > 0;
+}
+
+bool
+redblack_cursor_seek_by_rank(RedBlackCursor *cursor, size_t rank) {
+    RedBlackNode *node = cursor->tree->root;
+    size_t left_rank = rank;
+    cursor->depth = 0;
+    while(node) {
+        cursor->path[cursor->depth++] = node;
+        size_t left_num = get_sub_node_num(node->left);
+        if(left_rank < left_num + 1)
+            node = node->left;
+        else if(left_rank > left_num + 1) {
+            left_rank -= left_num + 1;
+            node = node->right;
+        }
+        else {
+            cursor->rank = rank;
+            return true;
+        }
+    }
+    cursor->depth = 0;
+    return false;
+}
+
+bool
+redblack_cursor_next(RedBlackCursor *cursor) {
+    if(cursor->depth == 0)
+        return false;
+    RedBlackNode *node = cursor->path[cursor->depth - 1]->right;
+    if(node) {
+        for(;node;node = node->left)
+            cursor->path[cursor->depth++] = node;
+    }
+    else {
+        RedBlackNode *child;
+        do {
+            child = cursor->path[--cursor->depth];
+        } while(cursor->depth > 0 && cursor->path[cursor->depth - 1]->right == child);
+    }
+    cursor->rank++;
+    return cursor->depth > 0;
+}
+
+bool
+redblack_cursor_prev(RedBlackCursor *cursor) {
+    if(cursor->depth == 0)
+        return false;
+    RedBlackNode *node = cursor->path[cursor->depth - 1]->left;
+    if(node) {
+        for(;node;node = node->right)
+            cursor->path[cursor->depth++] = node;
+    }
+    else {
+        RedBlackNode *child;
+        do {
+            child = cursor->path[--cursor->depth];
+        } while(cursor->depth > 0 && cursor->path[cursor->depth - 1]->left == child);
+    }
+    cursor->rank--;
+    return cursor->depth > 0;
+}
+
+bool
+redblack_cursor_is_valid(RedBlackCursor *cursor) {
+    return cursor->depth > 0;
+}
+
+void *
+redblack_cursor_get(RedBlackCursor *cursor) {
+    assert(cursor->depth > 0);
+    return cursor->path[cursor->depth - 1]->data;
+}
+
+size_t
+redblack_cursor_get_rank(RedBlackCursor *cursor) {
+    assert(cursor->depth > 0);
+    return cursor->rank;
+}
+
+void
+redblack_traverse(RedBlackBST *tree) {
+    traverse_tree(tree, tree->root);
+}
+
+bool
+redblack_is_empty(RedBlackBST *tree) {
+    if(uses_backend(tree))
+        return tree->node_num == 0;
+    return tree->root == NULL;
+}
+
+size_t
+redblack_get_node_num(RedBlackBST *tree) {
+    return tree->node_num;
+}
+
+FreeFunc
+redblack_get_free_func(RedBlackBST *tree) {
+    return tree->free_func;
+}
+
+RedBlackNode *
+redblack_get_root(RedBlackBST *tree) {
+    return tree->root;
+}
+
+RedBlackNode *
+redblack_get_left(RedBlackNode *node) {
+    return node->left;
+}
+
+RedBlackNode *
+redblack_get_right(RedBlackNode *node) {
+    return node->right;
+}
+
+void *
+redblack_get_data(RedBlackNode *node) {
+    return node->data;
+}
+
+const char *
+redblack_get_draw_str(RedBlackBST *tree, RedBlackNode *node) {
+    return tree->get_draw_str_func(node);
+}
+
+size_t
+redblack_get_sub_node_num(RedBlackNode *node) {
+    return get_sub_node_num(node);
+}
+
+bool
+redblack_is_red(RedBlackNode *node) {
+    return is_red(node);
+}
+
+static bool
+update_key(RedBlackBST *tree, void *data) {
+    IdEntry *entry = index_find(&tree->id_index, tree->get_id_func(data));
+    if(entry == NULL)
+        return false;
+    if(uses_backend(tree)) {
+        void *removed_data;
+        backend_remove(tree, entry->data, &removed_data);
+        tree->update_func(removed_data, data);
+        backend_insert(tree, removed_data);
+        return true;
+    }
+    RedBlackNode *removed = detach(tree, entry->data, data);
+    if(removed == NULL)
+        return true;
+    own_data(tree, removed);
+    tree->update_func(removed->data, data);
+    tree->root = insert(tree, tree->root, removed->data, removed);
+    tree->root->color = BLACK;
+    return true;
+}
+
+static void
+upsert(RedBlackBST *tree, void *data) {
+    if(index_find(&tree->id_index, tree->get_id_func(data))) {
+        update_key(tree, data);
+        tree->free_func(data);
+    }
+    else
+        redblack_insert(tree, data);
+}
+
+/* the stored items being updated are taken out of the flattened tree, updated and merged back together
+ * with the new items, reusing their nodes */
+static void
+upsert_merge(RedBlackBST *tree, void **sorted, size_t n) {
+    IdIndex updates = {NULL, 0, 0};
+    for(size_t i = 0;i < n;i++) {
+        IdEntry *entry = index_find(&tree->id_index, tree->get_id_func(sorted[i]));
+        if(entry)
+            index_set(&updates, (uintptr_t)entry->data, (void *)(uintptr_t)(i + 1));
+    }
+    RedBlackNode **reused = calloc(n, sizeof(*reused));
+    RedBlackNode **old_nodes = malloc(tree->node_num * sizeof(*old_nodes));
+    size_t old_num = flatten(tree, old_nodes);
+    size_t kept_num = 0;
+    for(size_t i = 0;i < old_num;i++) {
+        RedBlackNode *node = old_nodes[i];
+        IdEntry *entry = updates.entry_num ? index_find(&updates, (uintptr_t)node->data) : NULL;
+        if(entry == NULL) {
+            old_nodes[kept_num++] = node;
+            continue;
+        }
+        size_t j = (uintptr_t)entry->data - 1;
+        own_data(tree, node);
+        tree->update_func(node->data, sorted[j]);
+        node->key = get_key(tree, node->data);
+        tree->free_func(sorted[j]);
+        sorted[j] = node->data;
+        reused[j] = node;
+    }
+    RedBlackNode **nodes = malloc((kept_num + n) * sizeof(*nodes));
+    size_t node_num = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while(j < n) {
+        uint64_t key = get_key(tree, sorted[j]);
+        if(i < kept_num && compare(tree, sorted[j], key, old_nodes[i]) > 0) {
+            nodes[node_num++] = old_nodes[i++];
+            continue;
+        }
+        RedBlackNode *node = reused[j];
+        if(node == NULL) {
+            node = pool_alloc(tree->pool);
+            STATS_ADD(tree, alloc_num, 1);
+            node->key = key;
+            node->data = sorted[j];
+            node->ref_num = 1;
+            index_put(tree, node->data);
+        }
+        nodes[node_num++] = node;
+        j++;
+    }
+    while(i < kept_num)
+        nodes[node_num++] = old_nodes[i++];
+    tree->root = build_from_nodes(nodes, node_num, NULL);
+    aggregate_all(tree, tree->root);
+    tree->node_num = node_num;
+    free(nodes);
+    free(old_nodes);
+    free(reused);
+    free(updates.entries);
+}
+
+static bool
+remove_data(RedBlackBST *tree, void *data, void **removed_data) {
+    if(uses_backend(tree)) {
+        void *removed;
+        if(!backend_remove(tree, data, &removed))
+            return false;
+        tree->node_num--;
+        if(tree->get_id_func)
+            index_remove(tree, removed);
+        if(removed_data)
+            *removed_data = removed;
+        else
+            tree->free_func(removed);
+        return true;
+    }
+    RedBlackNode *removed = detach(tree, data, NULL);
+    if(removed == NULL)
+        return false;
+    remove_node(tree, removed, removed_data);
+    return true;
+}
+
+static size_t
+collect_extremes(RedBlackNode *node, size_t n, void **items, bool from_max) {
+    RedBlackNode *path[REDBLACK_MAX_HEIGHT];
+    int depth = 0;
+    size_t item_num = 0;
+    while(item_num < n && (node || depth > 0)) {
+        while(node) {
+            path[depth++] = node;
+            node = from_max ? node->right : node->left;
+        }
+        node = path[--depth];
+        items[item_num++] = node->data;
+        node = from_max ? node->left : node->right;
+    }
+    return item_num;
+}
+
+static size_t
+pop_extremes(RedBlackBST *tree, size_t n, void **items, bool from_max) {
+    if(n > tree->node_num)
+        n = tree->node_num;
+    if(n == 0)
+        return 0;
+    if(uses_backend(tree)) {
+        backend_get_extremes(tree, n, items, from_max);
+        for(size_t i = 0;i < n;i++)
+            remove_data(tree, items[i], &items[i]);
+        return n;
+    }
+    assert(tree->copy_func || is_unshared(tree->pool));
+    SubTree left, right;
+    split_by_rank(tree, sub_tree(tree->root), from_max ? tree->node_num - n : n, &left, &right);
+    RedBlackNode *popped = from_max ? right.root : left.root;
+    tree->root = from_max ? left.root : right.root;
+    tree->node_num -= n;
+    take_nodes(tree, popped, false, items, 0, from_max);
+    if(tree->get_id_func) {
+        for(size_t i = 0;i < n;i++)
+            index_remove(tree, items[i]);
+    }
+    return n;
+}
+
+/* the range is cut out with two splits and the parts around it joined on the smallest item after it,
+ * so only the paths along its ends are rebalanced */
+static size_t
+delete_range(RedBlackBST *tree, size_t start_rank, size_t end_rank) {
+    if(start_rank < 1)
+        start_rank = 1;
+    if(end_rank > tree->node_num)
+        end_rank = tree->node_num;
+    if(start_rank > end_rank)
+        return 0;
+    size_t removed_num = end_rank - start_rank + 1;
+    if(uses_backend(tree)) {
+        for(size_t i = 0;i < removed_num;i++)
+            remove_data(tree, backend_get_by_rank(tree, start_rank), NULL);
+        return removed_num;
+    }
+    SubTree left, middle, right, pivot, rest;
+    split_by_rank(tree, sub_tree(tree->root), end_rank, &left, &right);
+    split_by_rank(tree, left, start_rank - 1, &left, &middle);
+    if(right.root == NULL)
+        tree->root = left.root;
+    else {
+        split_by_rank(tree, right, 1, &pivot, &rest);
+        tree->root = join(tree, left, pivot.root, rest).root;
+    }
+    tree->node_num -= removed_num;
+    if(tree->get_id_func)
+        unindex_nodes(tree, middle.root);
+    free_all_nodes(tree, middle.root);
+    return removed_num;
+}
+
+static void
+get_range_by_rank(RedBlackNode *node, size_t start_rank, size_t end_rank, size_t left_rank, TraverseRangeFunc func) {
+    if(node == NULL)
+        return;
+    size_t node_rank = get_sub_node_num(node->left) + 1 + left_rank;
+    if(node_rank > start_rank)
+        get_range_by_rank(node->left, start_rank, end_rank, left_rank, func);
+    if(node_rank >= start_rank && node_rank <= end_rank)
+        func(node->data);
+    if(node_rank < end_rank)
+        get_range_by_rank(node->right, start_rank, end_rank, node_rank, func);
+}
+
+/* the range is the left edge of the node where its ends part, that node and its right edge */
+static bool
+aggregate_by_rank(RedBlackBST *tree, size_t start_rank, size_t end_rank, void *aggregate) {
+    if(start_rank < 1)
+        start_rank = 1;
+    if(end_rank > tree->node_num)
+        end_rank = tree->node_num;
+    if(start_rank > end_rank)
+        return false;
+    RedBlackNode *node = tree->root;
+    size_t left_rank = 0;
+    size_t node_rank;
+    for(;;) {
+        node_rank = get_sub_node_num(node->left) + 1 + left_rank;
+        if(node_rank < start_rank) {
+            left_rank = node_rank;
+            node = node->right;
+        }
+        else if(node_rank > end_rank)
+            node = node->left;
+        else
+            break;
+    }
+    size_t word_num = (tree->aggregate_size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    uint64_t buffers[4 * word_num];
+    void *left = aggregate_edge(tree, node->left, start_rank - left_rank, true, buffers);
+    void *right = aggregate_edge(tree, node->right, end_rank - node_rank, false, buffers + 2 * word_num);
+    tree->aggregate_func(aggregate, node->data, left, right);
+    return true;
+}
+
+/* folds the items of node's subtree ranked from rank on with suffix, or up to rank without, into one of
+ * the two aggregates in buffers; the nodes whose item is in range are collected on the way down and folded
+ * with the subtree on their far side on the way up */
+static void *
+aggregate_edge(RedBlackBST *tree, RedBlackNode *node, size_t rank, bool suffix, uint64_t *buffers) {
+    RedBlackNode *path[REDBLACK_MAX_HEIGHT];
+    int depth = 0;
+    while(node) {
+        size_t node_rank = get_sub_node_num(node->left) + 1;
+        bool in_range = suffix ? rank <= node_rank : rank >= node_rank;
+        if(in_range)
+            path[depth++] = node;
+        if(in_range == suffix)
+            node = node->left;
+        else {
+            rank -= node_rank;
+            node = node->right;
+        }
+    }
+    size_t word_num = (tree->aggregate_size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    void *acc = NULL;
+    while(depth > 0) {
+        node = path[--depth];
+        void *out = acc == buffers ? buffers + word_num : buffers;
+        if(suffix)
+            tree->aggregate_func(out, node->data, acc, get_aggregate(node->right));
+        else
+            tree->aggregate_func(out, node->data, get_aggregate(node->left), acc);
+        acc = out;
+    }
+    return acc;
+}
+
+static void
+map_range(RedBlackNode *node, size_t start_rank, size_t end_rank, size_t left_rank, MapFunc map_func, void *acc) {
+    if(node == NULL)
+        return;
+    size_t node_rank = get_sub_node_num(node->left) + 1 + left_rank;
+    if(node_rank > start_rank)
+        map_range(node->left, start_rank, end_rank, left_rank, map_func, acc);
+    if(node_rank >= start_rank && node_rank <= end_rank)
+        map_func(acc, node->data);
+    if(node_rank < end_rank)
+        map_range(node->right, start_rank, end_rank, node_rank, map_func, acc);
+}
+
+/* the right half folds into a fresh accumulator that is reduced into acc once both halves are done */
+static void
+map_task(void *arg) {
+    MapTask *task = arg;
+    RedBlackNode *node = task->node;
+    if(node == NULL)
+        return;
+    size_t first_rank = task->left_rank + 1 > task->start_rank ? task->left_rank + 1 : task->start_rank;
+    size_t last_rank = task->left_rank + get_sub_node_num(node);
+    if(last_rank > task->end_rank)
+        last_rank = task->end_rank;
+    if(first_rank > last_rank)
+        return;
+    if(last_rank - first_rank < PARALLEL_GRAIN) {
+        map_range(node, task->start_rank, task->end_rank, task->left_rank, task->map_func, task->acc);
+        return;
+    }
+    size_t node_rank = get_sub_node_num(node->left) + 1 + task->left_rank;
+    MapTask left = *task;
+    left.node = node->left;
+    MapTask right = *task;
+    right.node = node->right;
+    right.left_rank = node_rank;
+    right.acc = malloc(task->acc_size);
+    memcpy(right.acc, task->identity, task->acc_size);
+    redblack_thread_pool_fork_join(task->thread_pool, map_task, &left, map_task, &right);
+    if(node_rank >= task->start_rank && node_rank <= task->end_rank)
+        task->map_func(task->acc, node->data);
+    task->reduce_func(task->acc, right.acc);
+    free(right.acc);
+}
+
+static void
+get_range_by_score(RedBlackNode *node,
+        void *min_data, void *max_data,
+        TraverseRangeFunc traverse_func, CmpScoreFunc cmp_score_func) {
+    if(node == NULL)
+        return;
+    int result_min = cmp_score_func(node->data, min_data);
+    int result_max = cmp_score_func(node->data, max_data);
+    if(result_min >= 0)
+        get_range_by_score(node->left, min_data, max_data, traverse_func, cmp_score_func);
+    if(result_min >= 0 && result_max <= 0)
+        traverse_func(node->data);
+    if(result_max <= 0)
+        get_range_by_score(node->right, min_data, max_data, traverse_func, cmp_score_func);
+}
+
+static RedBlackNode *
+build(RedBlackNode **nodes, size_t n, int black_height, const size_t *max_num) {
+    if(n == 0)
+        return NULL;
+    RedBlackNode *node;
+    if(n - 1 <= 2 * max_num[black_height - 1]) {
+        size_t left_num = n / 2;
+        node = nodes[left_num];
+        node->left = build(nodes, left_num, black_height - 1, max_num);
+        node->right = build(nodes + left_num + 1, n - left_num - 1, black_height - 1, max_num);
+    }
+    else {
+        size_t part_num = (n - 2) / 3;
+        size_t left_num = part_num + ((n - 2) % 3 > 0);
+        size_t mid_num = part_num + ((n - 2) % 3 > 1);
+        RedBlackNode *red = nodes[left_num];
+        red->left = build(nodes, left_num, black_height - 1, max_num);
+        red->right = build(nodes + left_num + 1, mid_num, black_height - 1, max_num);
+        red->color = RED;
+        red->sub_node_num = left_num + mid_num + 1;
+        node = nodes[left_num + mid_num + 1];
+        node->left = red;
+        node->right = build(nodes + left_num + mid_num + 2, part_num, black_height - 1, max_num);
+    }
+    node->color = BLACK;
+    node->sub_node_num = n;
+    return node;
+}
+
+/* build with the subtrees of large nodes built on other workers */
+static RedBlackNode *
+build_parallel(RedBlackNode **nodes, size_t n, int black_height, const size_t *max_num,
+        RedBlackThreadPool *thread_pool) {
+    if(thread_pool == NULL || n <= PARALLEL_GRAIN)
+        return build(nodes, n, black_height, max_num);
+    RedBlackNode *node;
+    BuildTask tasks[3];
+    if(n - 1 <= 2 * max_num[black_height - 1]) {
+        size_t left_num = n / 2;
+        node = nodes[left_num];
+        tasks[0] = (BuildTask){nodes, left_num, black_height - 1, max_num, thread_pool, NULL};
+        tasks[1] = (BuildTask){nodes + left_num + 1, n - left_num - 1, black_height - 1, max_num, thread_pool, NULL};
+        build_tasks(tasks, 2);
+        node->left = tasks[0].root;
+        node->right = tasks[1].root;
+    }
+    else {
+        size_t part_num = (n - 2) / 3;
+        size_t left_num = part_num + ((n - 2) % 3 > 0);
+        size_t mid_num = part_num + ((n - 2) % 3 > 1);
+        RedBlackNode *red = nodes[left_num];
+        node = nodes[left_num + mid_num + 1];
+        tasks[0] = (BuildTask){nodes, left_num, black_height - 1, max_num, thread_pool, NULL};
+        tasks[1] = (BuildTask){nodes + left_num + 1, mid_num, black_height - 1, max_num, thread_pool, NULL};
+        tasks[2] = (BuildTask){nodes + left_num + mid_num + 2, part_num, black_height - 1, max_num, thread_pool, NULL};
+        build_tasks(tasks, 3);
+        red->left = tasks[0].root;
+        red->right = tasks[1].root;
+        red->color = RED;
+        red->sub_node_num = left_num + mid_num + 1;
+        node->left = red;
+        node->right = tasks[2].root;
+    }
+    node->color = BLACK;
+    node->sub_node_num = n;
+    return node;
+}
+
+static void
+build_task(void *arg) {
+    BuildTask *task = arg;
+    task->root = build_parallel(task->nodes, task->n, task->black_height, task->max_num, task->thread_pool);
+}
+
+static void
+build_pair_task(void *arg) {
+    build_tasks(arg, 2);
+}
+
+static void
+build_tasks(BuildTask *tasks, int task_num) {
+    if(task_num == 2)
+        redblack_thread_pool_fork_join(tasks->thread_pool, build_task, &tasks[0], build_task, &tasks[1]);
+    else
+        redblack_thread_pool_fork_join(tasks->thread_pool, build_task, &tasks[0], build_pair_task, &tasks[1]);
+}
+
+static RedBlackNode *
+build_from_nodes(RedBlackNode **nodes, size_t n, RedBlackThreadPool *thread_pool) {
+    /* a subtree of black height h holds between 2^h - 1 and 3^h - 1 nodes */
+    size_t max_num[sizeof(size_t) * 8 + 1];
+    max_num[0] = 0;
+    for(size_t i = 1;i < sizeof(max_num) / sizeof(max_num[0]);i++)
+        max_num[i] = max_num[i - 1] > (SIZE_MAX - 2) / 3 ? SIZE_MAX : max_num[i - 1] * 3 + 2;
+    int black_height = 0;
+    while(black_height < (int)(sizeof(size_t) * 8) && (((size_t)2 << black_height) - 1) <= n)
+        black_height++;
+    return build_parallel(nodes, n, black_height, max_num, thread_pool);
+}
+
+static void
+build_sorted(RedBlackBST *tree, void **items, size_t n, RedBlackThreadPool *thread_pool) {
+    if(n == 0)
+        return;
+    RedBlackNode **nodes = malloc(n * sizeof(*nodes));
+    RedBlackNode *block = pool_alloc_block(tree->pool, n);
+    STATS_ADD(tree, alloc_num, n);
+    for(size_t i = 0;i < n;i++)
+        nodes[i] = block ? pool_node_at(tree->pool, block, i) : pool_alloc(tree->pool);
+    FillTask task = {tree, items, nodes, n, thread_pool};
+    fill_task(&task);
+    if(tree->get_id_func) {
+        for(size_t i = 0;i < n;i++)
+            index_put(tree, items[i]);
+    }
+    tree->root = build_from_nodes(nodes, n, thread_pool);
+    aggregate_all(tree, tree->root);
+    tree->node_num = n;
+    free(nodes);
+}
+
+static void
+build_sorted_task(void *arg) {
+    FillTask *task = arg;
+    build_sorted(task->tree, task->items, task->n, task->thread_pool);
+}
+
+static void
+fill_task(void *arg) {
+    FillTask *task = arg;
+    if(task->thread_pool && task->n > PARALLEL_GRAIN) {
+        size_t half_num = task->n / 2;
+        FillTask left = {task->tree, task->items, task->nodes, half_num, task->thread_pool};
+        FillTask right = {task->tree, task->items + half_num, task->nodes + half_num, task->n - half_num,
+            task->thread_pool};
+        redblack_thread_pool_fork_join(task->thread_pool, fill_task, &left, fill_task, &right);
+        return;
+    }
+    for(size_t i = 0;i < task->n;i++) {
+        task->nodes[i]->key = get_key(task->tree, task->items[i]);
+        task->nodes[i]->data = task->items[i];
+        task->nodes[i]->ref_num = 1;
+    }
+}
+
+static size_t
+flatten(RedBlackBST *tree, RedBlackNode **nodes) {
+    RedBlackNode *path[REDBLACK_MAX_HEIGHT];
+    int depth = 0;
+    size_t n = 0;
+    RedBlackNode *node = tree->root = own(tree, tree->root);
+    while(node || depth > 0) {
+        while(node) {
+            path[depth++] = node;
+            node = node->left = own(tree, node->left);
+        }
+        node = path[--depth];
+        nodes[n++] = node;
+        node = node->right = own(tree, node->right);
+    }
+    return n;
+}
+
+static void
+sort_items(RedBlackBST *tree, void **items, void **buffer, size_t n) {
+    void **from = items;
+    void **to = buffer;
+    for(size_t width = 1;width < n;width *= 2) {
+        for(size_t lo = 0;lo < n;lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            size_t i = lo;
+            size_t j = mid;
+            size_t k = lo;
+            while(i < mid && j < hi) {
+                STATS_ADD(tree, cmp_num, 1);
+                to[k++] = tree->cmp_func(from[j], from[i]) < 0 ? from[j++] : from[i++];
+            }
+            while(i < mid)
+                to[k++] = from[i++];
+            while(j < hi)
+                to[k++] = from[j++];
+        }
+        void **swap = from;
+        from = to;
+        to = swap;
+    }
+    if(from != items)
+        memcpy(items, from, n * sizeof(*items));
+}
+
+static size_t
+count_less(RedBlackBST *tree, RedBlackNode *node, void *data, bool *found) {
+    size_t less_num = 0;
+    uint64_t key = get_key(tree, data);
+    *found = false;
+    while(node) {
+        int result = compare(tree, data, key, node);
+        if(result > 0) {
+            less_num += get_sub_node_num(node->left) + 1;
+            node = node->right;
+        }
+        else {
+            if(result == 0) {
+                *found = true;
+                return less_num + get_sub_node_num(node->left);
+            }
+            node = node->left;
+        }
+    }
+    return less_num;
+}
+
+static size_t
+count_by_score(RedBlackNode *node, void *data, CmpScoreFunc cmp_score_func, bool inclusive) {
+    size_t num = 0;
+    while(node) {
+        int result = cmp_score_func(node->data, data);
+        if(result < 0 || (inclusive && result == 0)) {
+            num += get_sub_node_num(node->left) + 1;
+            node = node->right;
+        }
+        else
+            node = node->left;
+    }
+    return num;
+}
+
+/* counts the items below each boundary in one descent, the boundaries above a node going right with it */
+static void
+count_less_many(RedBlackNode *node, void **boundaries, size_t k, CmpScoreFunc cmp_score_func,
+        size_t less_num, size_t *less_nums) {
+    while(k > 0 && node) {
+        size_t lo = 0;
+        size_t hi = k;
+        while(lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if(cmp_score_func(node->data, boundaries[mid]) < 0)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        count_less_many(node->left, boundaries, lo, cmp_score_func, less_num, less_nums);
+        less_num += get_sub_node_num(node->left) + 1;
+        boundaries += lo;
+        less_nums += lo;
+        k -= lo;
+        node = node->right;
+    }
+    for(size_t i = 0;i < k;i++)
+        less_nums[i] = less_num;
+}
+
+static RedBlackNode *
+get_by_rank(RedBlackNode *node, size_t rank) {
+    while(node) {
+        size_t left_num = get_sub_node_num(node->left);
+        if(rank < left_num + 1)
+            node = node->left;
+        else if(rank > left_num + 1) {
+            rank -= left_num + 1;
+            node = node->right;
+        }
+        else
+            return node;
+    }
+    return NULL;
+}
+
+static RedBlackNode *
+delete(RedBlackBST *tree, RedBlackNode *root, void *data, RedBlackNode **removed, void *new_data) {
+    RedBlackNode *path[REDBLACK_MAX_HEIGHT];
+    bool dirs[REDBLACK_MAX_HEIGHT];
+    int depth = 0;
+    RedBlackNode *node = root;
+    RedBlackNode *lower = NULL;
+    RedBlackNode *upper = NULL;
+    uint64_t key = get_key(tree, data);
+    for(;;) {
+        int result = compare(tree, data, key, node);
+        if(result < 0) {
+            if(node->left == NULL)
+                return unwind(tree, path, dirs, depth, balance(tree, node));
+            if(!is_red(node->left) && !is_red(node->left->left))
+                node = move_red_from_right_to_left(tree, node);
+            path[depth] = node;
+            dirs[depth++] = false;
+            upper = node;
+            node = node->left = own(tree, node->left);
+            continue;
+        }
+        if(is_red(node->left)) {
+            node = rotate_right(tree, node);
+            result = 1;
+        }
+        if(node->right == NULL) {
+            if(result != 0)
+                return unwind(tree, path, dirs, depth, balance(tree, node));
+            if(new_data && fits_between(tree, node, lower, upper, new_data)) {
+                own_data(tree, node);
+                tree->update_func(node->data, new_data);
+                node->key = get_key(tree, node->data);
+                return unwind(tree, path, dirs, depth, balance(tree, node));
+            }
+            *removed = node;
+            return unwind(tree, path, dirs, depth, NULL);
+        }
+        if(!is_red(node->right) && !is_red(node->right->left)) {
+            RedBlackNode *old_node = node;
+            node = move_red_from_left_to_right(tree, node);
+            if(node != old_node)
+                result = 1;
+        }
+        if(result == 0 && new_data && fits_between(tree, node, lower, upper, new_data)) {
+            own_data(tree, node);
+            tree->update_func(node->data, new_data);
+            node->key = get_key(tree, node->data);
+            return unwind(tree, path, dirs, depth, balance(tree, node));
+        }
+        path[depth] = node;
+        dirs[depth++] = true;
+        if(result == 0)
+            break;
+        lower = node;
+        node = node->right = own(tree, node->right);
+    }
+
+    RedBlackNode *target = node;
+    int target_depth = depth - 1;
+    node = node->right = own(tree, node->right);
+    while(node->left) {
+        if(!is_red(node->left) && !is_red(node->left->left))
+            node = move_red_from_right_to_left(tree, node);
+        path[depth] = node;
+        dirs[depth++] = false;
+        node = node->left = own(tree, node->left);
+    }
+    node->left = target->left;
+    node->right = target->right;
+    node->color = target->color;
+    path[target_depth] = node;
+    *removed = target;
+    return unwind(tree, path, dirs, depth, NULL);
+}
+
+static bool
+fits_between(RedBlackBST *tree, RedBlackNode *node, RedBlackNode *lower, RedBlackNode *upper, void *data) {
+    if(node->left)
+        lower = get_max(node->left);
+    if(node->right)
+        upper = get_min(node->right);
+    uint64_t key = get_key(tree, data);
+    return (lower == NULL || compare(tree, data, key, lower) > 0)
+        && (upper == NULL || compare(tree, data, key, upper) < 0);
+}
+
+static RedBlackNode *
+delete_max(RedBlackBST *tree, RedBlackNode *root) {
+    RedBlackNode *path[REDBLACK_MAX_HEIGHT];
+    bool dirs[REDBLACK_MAX_HEIGHT];
+    int depth = 0;
+    RedBlackNode *node = root;
+    for(;;) {
+        if(is_red(node->left))
+            node = rotate_right(tree, node);
+        if(node->right == NULL)
+            break;
+        if(!is_red(node->right) && !is_red(node->right->left))
+            node = move_red_from_left_to_right(tree, node);
+        path[depth] = node;
+        dirs[depth++] = true;
+        node = node->right = own(tree, node->right);
+    }
+    remove_node(tree, node, NULL);
+    return unwind(tree, path, dirs, depth, NULL);
+}
+
+static RedBlackNode *
+delete_min(RedBlackBST *tree, RedBlackNode *root) {
+    RedBlackNode *path[REDBLACK_MAX_HEIGHT];
+    bool dirs[REDBLACK_MAX_HEIGHT];
+    int depth = 0;
+    RedBlackNode *node = root;
+    while(node->left) {
+        if(!is_red(node->left) && !is_red(node->left->left))
+            node = move_red_from_right_to_left(tree, node);
+        path[depth] = node;
+        dirs[depth++] = false;
+        node = node->left = own(tree, node->left);
+    }
+    remove_node(tree, node, NULL);
+    return unwind(tree, path, dirs, depth, NULL);
+}
+
+static RedBlackNode *
+move_red_from_left_to_right(RedBlackBST *tree, RedBlackNode *node) {
+    flip_colors(tree, node);
+    if(is_red(node->left->left)) {
+        node = rotate_right(tree, node);
+        flip_colors(tree, node);
+    }
+    return node;
+}
+
+static RedBlackNode *
+move_red_from_right_to_left(RedBlackBST *tree, RedBlackNode *node) {
+    flip_colors(tree, node);
+    if(is_red(node->right->left)) {
+        node->right = rotate_right(tree, node->right);
+        node = rotate_left(tree, node);
+        flip_colors(tree, node);
+    }
+    return node;
+}
+
+static RedBlackNode *
+balance(RedBlackBST *tree, RedBlackNode *node) {
+    bool changed;
+    return rebalance(tree, node, &changed);
+}
+
+static RedBlackNode *
+rebalance(RedBlackBST *tree, RedBlackNode *node, bool *changed) {
+    *changed = false;
+    if(is_red(node->right) && !is_red(node->left)) {
+        node = rotate_left(tree, node);
+        *changed = true;
+    }
+    if(is_red(node->left) && is_red(node->left->left)) {
+        node = rotate_right(tree, node);
+        *changed = true;
+    }
+    if(is_red(node->left) && is_red(node->right)) {
+        flip_colors(tree, node);
+        *changed = true;
+    }
+    update_node(tree, node);
+    return node;
+}
+
+static RedBlackNode *
+unwind(RedBlackBST *tree, RedBlackNode **path, bool *dirs, int depth, RedBlackNode *node) {
+    while(depth > 0) {
+        RedBlackNode *parent = path[--depth];
+        if(dirs[depth])
+            parent->right = node;
+        else
+            parent->left = node;
+        node = balance(tree, parent);
+    }
+    return node;
+}
+
+/* moves the items of a popped subtree into items, largest first with from_max, and releases its nodes. a
+ * node a snapshot still holds keeps its subtree, and an item a snapshot still sees stays with it while the
+ * caller gets a copy */
+static size_t
+take_nodes(RedBlackBST *tree, RedBlackNode *node, bool shared, void **items, size_t item_num, bool from_max) {
+    if(node == NULL)
+        return item_num;
+    bool held = shared || node->ref_num > 1;
+    item_num = take_nodes(tree, from_max ? node->right : node->left, held, items, item_num, from_max);
+    items[item_num++] = held || unshare_data(tree, node->data) ? tree->copy_func(node->data) : node->data;
+    item_num = take_nodes(tree, from_max ? node->left : node->right, held, items, item_num, from_max);
+    if(!shared && --node->ref_num == 0)
+        pool_release(tree->pool, node);
+    return item_num;
+}
+
+static SubTree
+sub_tree(RedBlackNode *node) {
+    SubTree sub = {node, 0};
+    for(;node;node = node->left)
+        sub.black_height += !is_red(node);
+    return sub;
+}
+
+/* detaches a child of a black node as a black-rooted tree */
+static SubTree
+make_root(RedBlackBST *tree, RedBlackNode *node, int parent_height) {
+    SubTree sub = {node, parent_height - 1};
+    if(is_red(node)) {
+        sub.root = own(tree, node);
+        sub.root->color = BLACK;
+        sub.black_height++;
+    }
+    return sub;
+}
+
+/* joins two black-rooted trees around pivot, every item of left ordering before pivot and pivot
+ * before every item of right; pivot is hung at the matching black height and the path is rebalanced
+ * as after an insert */
+static SubTree
+join(RedBlackBST *tree, SubTree left, RedBlackNode *pivot, SubTree right) {
+    RedBlackNode *path[REDBLACK_MAX_HEIGHT];
+    bool dirs[REDBLACK_MAX_HEIGHT];
+    int depth = 0;
+    if(left.black_height == right.black_height) {
+        pivot->left = left.root;
+        pivot->right = right.root;
+        pivot->color = BLACK;
+        update_node(tree, pivot);
+        SubTree joined = {pivot, left.black_height + 1};
+        return joined;
+    }
+    RedBlackNode *node;
+    SubTree joined;
+    if(left.black_height > right.black_height) {
+        joined.black_height = left.black_height;
+        node = left.root;
+        for(int height = left.black_height;height > right.black_height;height--) {
+            node = own(tree, node);
+            path[depth] = node;
+            dirs[depth++] = true;
+            node = node->right;
+        }
+        pivot->left = node;
+        pivot->right = right.root;
+    }
+    else {
+        joined.black_height = right.black_height;
+        node = right.root;
+        for(int height = right.black_height;is_red(node) || height > left.black_height;) {
+            node = own(tree, node);
+            if(!is_red(node))
+                height--;
+            path[depth] = node;
+            dirs[depth++] = false;
+            node = node->left;
+        }
+        pivot->left = left.root;
+        pivot->right = node;
+    }
+    pivot->color = RED;
+    update_node(tree, pivot);
+    joined.root = unwind(tree, path, dirs, depth, pivot);
+    if(is_red(joined.root)) {
+        joined.root->color = BLACK;
+        joined.black_height++;
+    }
+    return joined;
+}
+
+/* the first rank items of node go to left and the rest to right */
+static void
+split_by_rank(RedBlackBST *tree, SubTree node, size_t rank, SubTree *left, SubTree *right) {
+    if(node.root == NULL) {
+        *left = node;
+        *right = node;
+        return;
+    }
+    RedBlackNode *pivot = own(tree, node.root);
+    SubTree sub_left = make_root(tree, pivot->left, node.black_height);
+    SubTree sub_right = make_root(tree, pivot->right, node.black_height);
+    size_t left_num = get_sub_node_num(sub_left.root);
+    SubTree rest;
+    if(rank <= left_num) {
+        split_by_rank(tree, sub_left, rank, left, &rest);
+        *right = join(tree, rest, pivot, sub_right);
+    }
+    else {
+        split_by_rank(tree, sub_right, rank - left_num - 1, &rest, right);
+        *left = join(tree, sub_left, pivot, rest);
+    }
+}
+
+/* items ordering before data go to left and the rest to right; with equal given, an item comparing equal
+ * to data is detached into it instead */
+static void
+split_by_key(RedBlackBST *tree, SubTree node, void *data, uint64_t key,
+        SubTree *left, SubTree *right, RedBlackNode **equal) {
+    if(node.root == NULL) {
+        *left = node;
+        *right = node;
+        return;
+    }
+    RedBlackNode *pivot = own(tree, node.root);
+    SubTree sub_left = make_root(tree, pivot->left, node.black_height);
+    SubTree sub_right = make_root(tree, pivot->right, node.black_height);
+    int result = compare(tree, data, key, pivot);
+    SubTree rest;
+    if(result == 0 && equal) {
+        *equal = pivot;
+        *left = sub_left;
+        *right = sub_right;
+    }
+    else if(result <= 0) {
+        split_by_key(tree, sub_left, data, key, left, &rest, equal);
+        *right = join(tree, rest, pivot, sub_right);
+    }
+    else {
+        split_by_key(tree, sub_right, data, key, &rest, right, equal);
+        *left = join(tree, sub_left, pivot, rest);
+    }
+}
+
+/* with dups given, duplicates of other are pushed onto it to be freed once the union is done, as
+ * the node pool and the id index are not safe to touch from several workers */
+static SubTree
+union_nodes(RedBlackBST *tree, SubTree node, SubTree other, size_t *dup_num,
+        RedBlackNode **dups, RedBlackThreadPool *thread_pool) {
+    if(other.root == NULL)
+        return node;
+    if(node.root == NULL)
+        return other;
+    if(thread_pool && get_sub_node_num(node.root) + get_sub_node_num(other.root) <= PARALLEL_GRAIN)
+        thread_pool = NULL;
+    RedBlackNode *pivot = own(tree, node.root);
+    SubTree sub_left = make_root(tree, pivot->left, node.black_height);
+    SubTree sub_right = make_root(tree, pivot->right, node.black_height);
+    SubTree left, right;
+    RedBlackNode *equal = NULL;
+    split_by_key(tree, other, pivot->data, pivot->key, &left, &right, &equal);
+    if(equal) {
+        own_data(tree, pivot);
+        tree->update_func(pivot->data, equal->data);
+        pivot->key = get_key(tree, pivot->data);
+        if(dups) {
+            equal->right = pivot;
+            RedBlackNode *head = __atomic_load_n(dups, __ATOMIC_RELAXED);
+            do
+                equal->left = head;
+            while(!__atomic_compare_exchange_n(dups, &head, equal, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        }
+        else {
+            if(tree->get_id_func)
+                index_put(tree, pivot->data);
+            free_one_node(tree, equal);
+        }
+        (*dup_num)++;
+    }
+    if(thread_pool) {
+        UnionTask tasks[2] = {
+            {tree, sub_left, left, {NULL, 0}, 0, dups, thread_pool},
+            {tree, sub_right, right, {NULL, 0}, 0, dups, thread_pool},
+        };
+        redblack_thread_pool_fork_join(thread_pool, union_task, &tasks[0], union_task, &tasks[1]);
+        left = tasks[0].joined;
+        right = tasks[1].joined;
+        *dup_num += tasks[0].dup_num + tasks[1].dup_num;
+    }
+    else {
+        left = union_nodes(tree, sub_left, left, dup_num, dups, NULL);
+        right = union_nodes(tree, sub_right, right, dup_num, dups, NULL);
     }
-    return balance(node);
+    return join(tree, left, pivot, right);
 }
 
-static RedBlackNode *
-delete_min(RedBlackBST *tree, RedBlackNode *node) {
-    if(node->left == NULL)
-        return NULL;
-    if(!is_red(node->left) && !is_red(node->left->left))
-        node = move_red_from_right_to_left(node);
-    RedBlackNode *old_left = node->left;
-    node->left = delete_min(tree, node->left);
-    if(node->left == NULL && old_left) {
-        tree->node_num--;
-        free_one_node(tree, old_left);
+static void
+union_task(void *arg) {
+    UnionTask *task = arg;
+    task->joined = union_nodes(task->tree, task->node, task->other, &task->dup_num, task->dups, task->thread_pool);
+}
+
+/* union only goes parallel when no snapshot shares a node, so that own never has to allocate */
+static void
+union_trees(RedBlackBST *tree, RedBlackBST *other, RedBlackThreadPool *thread_pool) {
+    assert(!tree->read_only && !other->read_only && !uses_backend(tree) && !uses_backend(other));
+    assert(tree->cmp_func == other->cmp_func && tree->get_key_func == other->get_key_func);
+    assert(tree->get_id_func == other->get_id_func && tree->aggregate_func == other->aggregate_func);
+    collect_released(tree->pool);
+    collect_released(other->pool);
+    if(!is_unshared(tree->pool) || !is_unshared(other->pool))
+        thread_pool = NULL;
+    adopt_pool(tree, other);
+    merge_index(tree, other);
+    RedBlackNode *dups = NULL;
+    UnionTask task = {tree, sub_tree(tree->root), sub_tree(other->root), {NULL, 0}, 0, NULL, thread_pool};
+    if(thread_pool) {
+        task.dups = &dups;
+        redblack_thread_pool_run(thread_pool, union_task, &task);
     }
-    return balance(node);
+    else
+        union_task(&task);
+    while(dups) {
+        RedBlackNode *equal = dups;
+        dups = equal->left;
+        if(tree->get_id_func)
+            index_put(tree, equal->right->data);
+        free_one_node(tree, equal);
+    }
+    tree->root = task.joined.root;
+    tree->node_num += other->node_num - task.dup_num;
+    release_tree(other);
 }
 
-static RedBlackNode *
-move_red_from_left_to_right(RedBlackNode *node) {
-    flip_colors(node);
-    if(is_red(node->left->left)) {
-        node = rotate_right(node);
-        flip_colors(node);
+static bool
+is_unshared(NodePool *pool) {
+    return __atomic_load_n(&pool->ref_num, __ATOMIC_ACQUIRE) == pool->tree_num && pool->shared_data.entry_num == 0;
+}
+
+/* moves other's nodes into tree's pool; a foreign pool must belong to other alone */
+static void
+adopt_pool(RedBlackBST *tree, RedBlackBST *other) {
+    NodePool *pool = other->pool;
+    if(pool == tree->pool) {
+        pool->tree_num--;
+        return;
     }
-    return node;
+    collect_released(pool);
+    assert(__atomic_load_n(&pool->ref_num, __ATOMIC_ACQUIRE) == 1 && pool->shared_data.entry_num == 0);
+    assert(pool->node_size == tree->pool->node_size);
+    if((pool->slab_node_num == 0) == (tree->pool->slab_node_num == 0))
+        pool_merge(tree->pool, pool);
+    else
+        other->root = relocate(tree, pool, other->root);
 }
 
 static RedBlackNode *
-move_red_from_right_to_left(RedBlackNode *node) {
-    flip_colors(node);
-    if(is_red(node->right->left)) {
-        node->right = rotate_right(node->right);
-        node = rotate_left(node);
-        flip_colors(node);
+relocate(RedBlackBST *tree, NodePool *pool, RedBlackNode *node) {
+    if(node == NULL)
+        return NULL;
+    RedBlackNode *copy = pool_alloc(tree->pool);
+    STATS_ADD(tree, alloc_num, 1);
+    memcpy(copy, node, tree->pool->node_size);
+    copy->left = relocate(tree, pool, node->left);
+    copy->right = relocate(tree, pool, node->right);
+    pool_release(pool, node);
+    return copy;
+}
+
+static void
+merge_index(RedBlackBST *tree, RedBlackBST *other) {
+    if(tree->get_id_func == NULL)
+        return;
+    if(other->id_index.entry_num > tree->id_index.entry_num) {
+        IdIndex index = tree->id_index;
+        tree->id_index = other->id_index;
+        other->id_index = index;
+    }
+    for(size_t i = 0;i < other->id_index.capacity;i++) {
+        IdEntry *entry = &other->id_index.entries[i];
+        if(entry->data && index_find(&tree->id_index, entry->id) == NULL)
+            index_set(&tree->id_index, entry->id, entry->data);
     }
-    return node;
 }
 
-static RedBlackNode *
-balance(RedBlackNode *node) {
-    if(is_red(node->right) && !is_red(node->left))
-        node = rotate_left(node);
-    if(is_red(node->left) && is_red(node->left->left))
-        node = rotate_right(node);
-    if(is_red(node->left) && is_red(node->right))
-        flip_colors(node);
-    node->sub_node_num = get_sub_node_num(node->left) + get_sub_node_num(node->right) + 1;
-    return node;
+static void
+move_index(RedBlackBST *from, RedBlackBST *to, RedBlackNode *node) {
+    if(node == NULL)
+        return;
+    index_remove(from, node->data);
+    index_put(to, node->data);
+    move_index(from, to, node->left);
+    move_index(from, to, node->right);
+}
+
+static void
+unindex_nodes(RedBlackBST *tree, RedBlackNode *node) {
+    if(node == NULL)
+        return;
+    index_remove(tree, node->data);
+    unindex_nodes(tree, node->left);
+    unindex_nodes(tree, node->right);
+}
+
+static void
+release_tree(RedBlackBST *tree) {
+    free(tree->id_index.entries);
+    pool_unref(tree->pool);
+    free(tree);
 }
 
 static void
@@ -348,76 +2359,521 @@ traverse_tree(RedBlackBST *tree, RedBlackNode *node) {
 
 static RedBlackNode *
 free_all_nodes(RedBlackBST *tree, RedBlackNode *node) {
-    if(node == NULL)
+    if(node == NULL || --node->ref_num > 0)
         return NULL;
     node->left = free_all_nodes(tree, node->left);
     node->right = free_all_nodes(tree, node->right);
-    tree->free_func(node->data);
-    free(node);
+    release_data(tree, node->data);
+    pool_release(tree->pool, node);
+    return NULL;
+}
+
+static RedBlackNode *
+detach(RedBlackBST *tree, void *data, void *new_data) {
+    if(redblack_is_empty(tree))
+        return NULL;
+    tree->root = own(tree, tree->root);
+    if(!is_red(tree->root->left) && !is_red(tree->root->right))
+        tree->root->color = RED;
+    RedBlackNode *removed = NULL;
+    tree->root = delete(tree, tree->root, data, &removed, new_data);
+    if(!redblack_is_empty(tree))
+        tree->root->color = BLACK;
+    return removed;
+}
+
+static void
+remove_node(RedBlackBST *tree, RedBlackNode *node, void **removed_data) {
+    tree->node_num--;
+    if(tree->get_id_func)
+        index_remove(tree, node->data);
+    if(removed_data) {
+        /* a snapshot still seeing the item keeps it, and the caller gets a copy of its own */
+        *removed_data = unshare_data(tree, node->data) ? tree->copy_func(node->data) : node->data;
+        pool_release(tree->pool, node);
+    }
+    else
+        free_one_node(tree, node);
+}
+
+static uint64_t
+hash_id(uint64_t id) {
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    id *= 0xc4ceb9fe1a85ec53ULL;
+    id ^= id >> 33;
+    return id;
+}
+
+static IdEntry *
+index_find(IdIndex *index, uint64_t id) {
+    if(index->capacity == 0)
+        return NULL;
+    size_t mask = index->capacity - 1;
+    size_t i = hash_id(id) & mask;
+    while(index->entries[i].data) {
+        if(index->entries[i].id == id)
+            return &index->entries[i];
+        i = (i + 1) & mask;
+    }
     return NULL;
 }
 
+static void
+index_set(IdIndex *index, uint64_t id, void *data) {
+    if((index->entry_num + 1) * 4 > index->capacity * 3)
+        index_resize(index, index->capacity ? index->capacity * 2 : 64);
+    size_t mask = index->capacity - 1;
+    size_t i = hash_id(id) & mask;
+    while(index->entries[i].data && index->entries[i].id != id)
+        i = (i + 1) & mask;
+    if(index->entries[i].data == NULL)
+        index->entry_num++;
+    index->entries[i].id = id;
+    index->entries[i].data = data;
+}
+
+static void
+index_put(RedBlackBST *tree, void *data) {
+    index_set(&tree->id_index, tree->get_id_func(data), data);
+}
+
+static void
+index_remove(RedBlackBST *tree, void *data) {
+    IdEntry *entry = index_find(&tree->id_index, tree->get_id_func(data));
+    if(entry)
+        index_erase(&tree->id_index, entry);
+}
+
+static void
+index_erase(IdIndex *index, IdEntry *entry) {
+    size_t mask = index->capacity - 1;
+    size_t i = entry - index->entries;
+    size_t j = i;
+    for(;;) {
+        j = (j + 1) & mask;
+        if(index->entries[j].data == NULL)
+            break;
+        size_t home = hash_id(index->entries[j].id) & mask;
+        if(((j - home) & mask) >= ((j - i) & mask)) {
+            index->entries[i] = index->entries[j];
+            i = j;
+        }
+    }
+    index->entries[i].data = NULL;
+    index->entry_num--;
+}
+
+static void
+index_resize(IdIndex *index, size_t capacity) {
+    IdEntry *old_entries = index->entries;
+    size_t old_capacity = index->capacity;
+    index->entries = calloc(capacity, sizeof(IdEntry));
+    index->capacity = capacity;
+    size_t mask = capacity - 1;
+    for(size_t i = 0;i < old_capacity;i++) {
+        if(old_entries[i].data == NULL)
+            continue;
+        size_t j = hash_id(old_entries[i].id) & mask;
+        while(index->entries[j].data)
+            j = (j + 1) & mask;
+        index->entries[j] = old_entries[i];
+    }
+    free(old_entries);
+}
+
+static void
+index_all(RedBlackBST *tree, RedBlackNode *node) {
+    if(node == NULL)
+        return;
+    index_put(tree, node->data);
+    index_all(tree, node->left);
+    index_all(tree, node->right);
+}
+
 static void
 free_one_node(RedBlackBST *tree, RedBlackNode *node) {
     if(node == NULL)
         return;
-    tree->free_func(node->data);
-    free(node);
+    release_data(tree, node->data);
+    pool_release(tree->pool, node);
+}
+
+static NodePool *
+pool_new(size_t slab_node_num) {
+    NodePool *pool = malloc(sizeof(*pool));
+    pool->slab_node_num = slab_node_num;
+    pool->node_size = sizeof(RedBlackNode);
+    pool->slabs = NULL;
+    pool->slab_used_num = 0;
+    pool->free_list = NULL;
+    pool->slab_num = 0;
+    pool->live_node_num = 0;
+    pool->free_node_num = 0;
+    pool->ref_num = 1;
+    pool->tree_num = 1;
+    pool->shared_data.entries = NULL;
+    pool->shared_data.capacity = 0;
+    pool->shared_data.entry_num = 0;
+    pool->released = NULL;
+    pool->draining = false;
+    pool->orphaned = false;
+    return pool;
+}
+
+static void
+pool_unref(NodePool *pool) {
+    if(__atomic_sub_fetch(&pool->ref_num, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    pool_destroy(pool);
+    free(pool->shared_data.entries);
+    free(pool);
+}
+
+/* a slab pool referenced by nothing but its one tree, whose nodes can then go with the slabs */
+static bool
+is_exclusive(NodePool *pool) {
+    return pool->slab_node_num > 0 && __atomic_load_n(&pool->ref_num, __ATOMIC_ACQUIRE) == 1;
+}
+
+static void
+keep_data(void *data) {
+}
+
+/* detaches the root; an exclusive tree whose items are not owned has nothing to visit at all */
+static void
+teardown_begin(Teardown *teardown, RedBlackBST *tree) {
+    teardown->tree = tree;
+    teardown->exclusive = is_exclusive(tree->pool);
+    teardown->depth = 0;
+    if(tree->root && !(teardown->exclusive && tree->free_func == keep_data))
+        teardown->stack[teardown->depth++] = tree->root;
+    tree->root = NULL;
+}
+
+/* frees up to budget nodes, taking them off it, and returns true once the tree itself is gone. a node still
+ * referenced by a snapshot or a split sibling is left to it along with its subtree */
+static bool
+teardown_run(Teardown *teardown, size_t *budget) {
+    RedBlackBST *tree = teardown->tree;
+    NodePool *pool = tree->pool;
+    while(teardown->depth > 0) {
+        if(*budget == 0)
+            return false;
+        (*budget)--;
+        RedBlackNode *node = teardown->stack[--teardown->depth];
+        if(!teardown->exclusive && --node->ref_num > 0)
+            continue;
+        if(node->right)
+            teardown->stack[teardown->depth++] = node->right;
+        if(node->left)
+            teardown->stack[teardown->depth++] = node->left;
+        if(teardown->exclusive)
+            tree->free_func(node->data);
+        else {
+            release_data(tree, node->data);
+            pool_release(pool, node);
+        }
+    }
+    if(uses_backend(tree))
+        backend_free(tree);
+    if(teardown->exclusive)
+        pool_destroy(pool);
+    free(tree->id_index.entries);
+    free(tree);
+    if(--pool->tree_num == 0) {
+        __atomic_store_n(&pool->orphaned, true, __ATOMIC_SEQ_CST);
+        drain_released(pool);
+    }
+    pool_unref(pool);
+    return true;
+}
+
+static RedBlackBST *
+reclaimer_pop(RedBlackReclaimer *reclaimer) {
+    RedBlackBST *tree = reclaimer->head;
+    if(tree) {
+        reclaimer->head = tree->next_released;
+        if(reclaimer->head == NULL)
+            reclaimer->tail = NULL;
+    }
+    return tree;
+}
+
+static void *
+reclaimer_main(void *arg) {
+    RedBlackReclaimer *reclaimer = arg;
+    pthread_mutex_lock(&reclaimer->lock);
+    for(;;) {
+        while(reclaimer->head == NULL && !reclaimer->stopping)
+            pthread_cond_wait(&reclaimer->cond, &reclaimer->lock);
+        RedBlackBST *tree = reclaimer_pop(reclaimer);
+        if(tree == NULL)
+            break;
+        pthread_mutex_unlock(&reclaimer->lock);
+        Teardown teardown;
+        size_t budget = SIZE_MAX;
+        teardown_begin(&teardown, tree);
+        teardown_run(&teardown, &budget);
+        pthread_mutex_lock(&reclaimer->lock);
+    }
+    pthread_mutex_unlock(&reclaimer->lock);
+    return NULL;
+}
+
+static void
+release_snapshot(RedBlackBST *snapshot) {
+    NodePool *pool = snapshot->pool;
+    __atomic_add_fetch(&pool->ref_num, 1, __ATOMIC_RELAXED);
+    RedBlackBST *head = __atomic_load_n(&pool->released, __ATOMIC_RELAXED);
+    do
+        snapshot->next_released = head;
+    while(!__atomic_compare_exchange_n(&pool->released, &head, snapshot,
+        true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    if(__atomic_load_n(&pool->orphaned, __ATOMIC_SEQ_CST))
+        drain_released(pool);
+    pool_unref(pool);
+}
+
+static void
+collect_released(NodePool *pool) {
+    if(__atomic_load_n(&pool->released, __ATOMIC_ACQUIRE))
+        drain_released(pool);
+}
+
+static void
+drain_released(NodePool *pool) {
+    while(__atomic_load_n(&pool->released, __ATOMIC_SEQ_CST)) {
+        if(__atomic_exchange_n(&pool->draining, true, __ATOMIC_SEQ_CST))
+            return;
+        RedBlackBST *snapshot = __atomic_exchange_n(&pool->released, NULL, __ATOMIC_ACQUIRE);
+        while(snapshot) {
+            RedBlackBST *next = snapshot->next_released;
+            snapshot->root = free_all_nodes(snapshot, snapshot->root);
+            pool_unref(pool);
+            free(snapshot);
+            snapshot = next;
+        }
+        __atomic_store_n(&pool->draining, false, __ATOMIC_SEQ_CST);
+    }
+}
+
+static RedBlackNode *
+pool_alloc_block(NodePool *pool, size_t node_num) {
+    if(pool->slab_node_num == 0)
+        return NULL;
+    NodeSlab *slab = malloc(sizeof(*slab) + node_num * pool->node_size);
+    slab->node_num = node_num;
+    if(pool->slabs) {
+        slab->next = pool->slabs->next;
+        pool->slabs->next = slab;
+    }
+    else {
+        slab->next = NULL;
+        pool->slabs = slab;
+        pool->slab_used_num = node_num;
+    }
+    pool->slab_num++;
+    pool->live_node_num += node_num;
+    return slab->nodes;
+}
+
+static RedBlackNode *
+pool_alloc(NodePool *pool) {
+    pool->live_node_num++;
+    if(pool->slab_node_num == 0)
+        return malloc(pool->node_size);
+    if(pool->free_list) {
+        RedBlackNode *node = pool->free_list;
+        pool->free_list = node->left;
+        pool->free_node_num--;
+        return node;
+    }
+    if(pool->slabs == NULL || pool->slab_used_num == pool->slabs->node_num) {
+        NodeSlab *slab = malloc(sizeof(*slab) + pool->slab_node_num * pool->node_size);
+        slab->next = pool->slabs;
+        slab->node_num = pool->slab_node_num;
+        pool->slabs = slab;
+        pool->slab_used_num = 0;
+        pool->slab_num++;
+        pool->free_node_num += slab->node_num;
+    }
+    pool->free_node_num--;
+    return pool_node_at(pool, pool->slabs->nodes, pool->slab_used_num++);
+}
+
+static RedBlackNode *
+pool_node_at(NodePool *pool, RedBlackNode *nodes, size_t i) {
+    return (RedBlackNode *)((char *)nodes + i * pool->node_size);
+}
+
+static void
+pool_release(NodePool *pool, RedBlackNode *node) {
+    pool->live_node_num--;
+    if(pool->slab_node_num == 0) {
+        free(node);
+        return;
+    }
+    node->left = pool->free_list;
+    pool->free_list = node;
+    pool->free_node_num++;
+}
+
+static void
+pool_merge(NodePool *pool, NodePool *other) {
+    assert(pool->node_size == other->node_size);
+    if(other->slabs) {
+        NodeSlab *slab = other->slabs;
+        while(other->slab_used_num < slab->node_num) {
+            RedBlackNode *node = pool_node_at(other, slab->nodes, other->slab_used_num++);
+            node->left = other->free_list;
+            other->free_list = node;
+        }
+        while(slab->next)
+            slab = slab->next;
+        if(pool->slabs) {
+            slab->next = pool->slabs->next;
+            pool->slabs->next = other->slabs;
+        }
+        else {
+            pool->slabs = other->slabs;
+            pool->slab_used_num = other->slabs->node_num;
+        }
+    }
+    while(other->free_list) {
+        RedBlackNode *node = other->free_list;
+        other->free_list = node->left;
+        node->left = pool->free_list;
+        pool->free_list = node;
+    }
+    pool->slab_num += other->slab_num;
+    pool->live_node_num += other->live_node_num;
+    pool->free_node_num += other->free_node_num;
+    other->slabs = NULL;
+    other->slab_used_num = 0;
+    other->slab_num = 0;
+    other->live_node_num = 0;
+    other->free_node_num = 0;
+}
+
+static void
+pool_destroy(NodePool *pool) {
+    NodeSlab *slab = pool->slabs;
+    while(slab) {
+        NodeSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    pool->slabs = NULL;
+    pool->slab_used_num = 0;
+    pool->free_list = NULL;
+    pool->slab_num = 0;
+    pool->live_node_num = 0;
+    pool->free_node_num = 0;
 }
 
 static RedBlackNode *
 get_max(RedBlackNode *node) {
-    if(node->right == NULL)
-        return node;
-    return get_max(node->right);
+    while(node->right)
+        node = node->right;
+    return node;
 }
 
 static RedBlackNode *
 get_min(RedBlackNode *node) {
-    if(node->left == NULL)
-        return node;
-    return get_min(node->left);
+    while(node->left)
+        node = node->left;
+    return node;
 }
 
 static void *
 get(RedBlackBST *tree, RedBlackNode *node, void *data) {
-    if(node == NULL)
-        return NULL;
-    int result = tree->cmp_func(data, node->data);
-    if(result == 0)
-        return node->data;
-    else if(result > 0)
-        return get(tree, node->right, data);
-    else
-        return get(tree, node->left, data);
+    uint64_t key = get_key(tree, data);
+    while(node) {
+        int result = compare(tree, data, key, node);
+        if(result == 0)
+            return node->data;
+        node = result > 0 ? node->right : node->left;
+    }
+    return NULL;
 }
 
 static RedBlackNode *
-new_node(void *data, Color color) {
-    RedBlackNode *node = malloc(sizeof(*node));
+new_node(RedBlackBST *tree, void *data, Color color) {
+    RedBlackNode *node = pool_alloc(tree->pool);
+    STATS_ADD(tree, alloc_num, 1);
+    node->key = get_key(tree, data);
     node->data = data;
     node->color = color;
     node->left = NULL;
     node->right = NULL;
-    node->sub_node_num = 1;
+    node->ref_num = 1;
+    update_node(tree, node);
     return node;
 }
 
 static RedBlackNode *
-insert(RedBlackBST *tree, RedBlackNode *node, void *data) {
-    if(node == NULL) {
+insert(RedBlackBST *tree, RedBlackNode *root, void *data, RedBlackNode *reuse_node) {
+    RedBlackNode *path[REDBLACK_MAX_HEIGHT];
+    bool dirs[REDBLACK_MAX_HEIGHT];
+    int depth = 0;
+    root = own(tree, root);
+    RedBlackNode *node = root;
+    uint64_t key = get_key(tree, data);
+    while(node) {
+        int result = compare(tree, data, key, node);
+        if(result == 0) {
+            assert(reuse_node == NULL);
+            own_data(tree, node);
+            tree->update_func(node->data, data);
+            node->key = get_key(tree, node->data);
+            if(tree->aggregate_func) {
+                update_node(tree, node);
+                while(depth > 0)
+                    update_node(tree, path[--depth]);
+            }
+            return root;
+        }
+        path[depth] = node;
+        dirs[depth++] = result > 0;
+        if(result > 0)
+            node = node->right = own(tree, node->right);
+        else
+            node = node->left = own(tree, node->left);
+    }
+    if(reuse_node) {
+        node = reuse_node;
+        node->key = key;
+        node->left = NULL;
+        node->right = NULL;
+        node->color = RED;
+        update_node(tree, node);
+    }
+    else {
         tree->node_num++;
-        return new_node(data, RED);
+        node = new_node(tree, data, RED);
+        if(tree->get_id_func)
+            index_put(tree, data);
     }
-    int result = tree->cmp_func(data, node->data);
-    if(result == 0)
-        tree->update_func(node->data, data);
-    else if(result > 0)
-        node->right = insert(tree, node->right, data);
-    else if(result < 0)
-        node->left = insert(tree, node->left, data);
 
-    return balance(node);
+    /* once two consecutive levels need no rotation or flip, nothing above them can change */
+    int quiet_num = 0;
+    while(depth > 0) {
+        RedBlackNode *parent = path[--depth];
+        if(quiet_num >= 2) {
+            update_node(tree, parent);
+            continue;
+        }
+        if(dirs[depth])
+            parent->right = node;
+        else
+            parent->left = node;
+        bool changed;
+        node = rebalance(tree, parent, &changed);
+        quiet_num = changed ? 0 : quiet_num + 1;
+    }
+    return quiet_num >= 2 ? root : node;
 }
 
 static bool
@@ -427,40 +2883,235 @@ is_red(RedBlackNode *node) {
     return node->color == RED ? true : false;
 }
 
+static uint64_t
+get_key(RedBlackBST *tree, void *data) {
+    return tree->get_key_func ? tree->get_key_func(data) : 0;
+}
+
 static int
+compare(RedBlackBST *tree, void *data, uint64_t key, RedBlackNode *node) {
+    if(key != node->key)
+        return key < node->key ? -1 : 1;
+    STATS_ADD(tree, cmp_num, 1);
+    return tree->cmp_func(data, node->data);
+}
+
+static size_t
 get_sub_node_num(RedBlackNode *node) {
     if(node == NULL)
         return 0;
     return node->sub_node_num;
 }
 
+static void *
+get_aggregate(RedBlackNode *node) {
+    return node ? node + 1 : NULL;
+}
+
+/* recomputes what a node keeps about its subtree from its children */
+static void
+update_node(RedBlackBST *tree, RedBlackNode *node) {
+    node->sub_node_num = get_sub_node_num(node->left) + get_sub_node_num(node->right) + 1;
+    if(tree->aggregate_func)
+        tree->aggregate_func(get_aggregate(node), node->data, get_aggregate(node->left), get_aggregate(node->right));
+}
+
+static void
+aggregate_all(RedBlackBST *tree, RedBlackNode *node) {
+    if(tree->aggregate_func == NULL || node == NULL)
+        return;
+    aggregate_all(tree, node->left);
+    aggregate_all(tree, node->right);
+    update_node(tree, node);
+}
+
 static RedBlackNode *
-rotate_left(RedBlackNode *node) {
-    RedBlackNode *sub_tree_root = node->right;
+rotate_left(RedBlackBST *tree, RedBlackNode *node) {
+    RedBlackNode *sub_tree_root = own(tree, node->right);
+    STATS_ADD(tree, rotate_left_num, 1);
     node->right = sub_tree_root->left;
     sub_tree_root->left = node;
     sub_tree_root->color = node->color;
     node->color = RED;
     sub_tree_root->sub_node_num = node->sub_node_num;
-    node->sub_node_num = get_sub_node_num(node->left) + get_sub_node_num(node->right) + 1;
+    if(tree->aggregate_func)
+        memcpy(get_aggregate(sub_tree_root), get_aggregate(node), tree->aggregate_size);
+    update_node(tree, node);
     return sub_tree_root;
 }
 
 static RedBlackNode *
-rotate_right(RedBlackNode *node) {
-    RedBlackNode *sub_tree_root = node->left;
+rotate_right(RedBlackBST *tree, RedBlackNode *node) {
+    RedBlackNode *sub_tree_root = own(tree, node->left);
+    STATS_ADD(tree, rotate_right_num, 1);
     node->left = sub_tree_root->right;
     sub_tree_root->right = node;
     sub_tree_root->color = node->color;
     node->color = RED;
     sub_tree_root->sub_node_num = node->sub_node_num;
-    node->sub_node_num = get_sub_node_num(node->left) + get_sub_node_num(node->right) + 1;
+    if(tree->aggregate_func)
+        memcpy(get_aggregate(sub_tree_root), get_aggregate(node), tree->aggregate_size);
+    update_node(tree, node);
     return sub_tree_root;
 }
 
 static void
-flip_colors(RedBlackNode *node) {
+flip_colors(RedBlackBST *tree, RedBlackNode *node) {
+    node->left = own(tree, node->left);
+    node->right = own(tree, node->right);
+    STATS_ADD(tree, flip_num, 1);
     node->color = !node->color;
     node->left->color = !node->left->color;
     node->right->color = !node->right->color;
 }
+
+static RedBlackNode *
+own(RedBlackBST *tree, RedBlackNode *node) {
+    if(node == NULL || node->ref_num == 1)
+        return node;
+    RedBlackNode *copy = pool_alloc(tree->pool);
+    STATS_ADD(tree, alloc_num, 1);
+    memcpy(copy, node, tree->pool->node_size);
+    copy->ref_num = 1;
+    node->ref_num--;
+    if(copy->left)
+        copy->left->ref_num++;
+    if(copy->right)
+        copy->right->ref_num++;
+    IdIndex *shared_data = &tree->pool->shared_data;
+    IdEntry *entry = index_find(shared_data, (uintptr_t)copy->data);
+    if(entry)
+        entry->data = (void *)((uintptr_t)entry->data + 1);
+    else
+        index_set(shared_data, (uintptr_t)copy->data, (void *)(uintptr_t)2);
+    return copy;
+}
+
+static bool
+unshare_data(RedBlackBST *tree, void *data) {
+    IdIndex *shared_data = &tree->pool->shared_data;
+    if(shared_data->entry_num == 0)
+        return false;
+    IdEntry *entry = index_find(shared_data, (uintptr_t)data);
+    if(entry == NULL)
+        return false;
+    uintptr_t ref_num = (uintptr_t)entry->data - 1;
+    if(ref_num == 1)
+        index_erase(shared_data, entry);
+    else
+        entry->data = (void *)ref_num;
+    return true;
+}
+
+static void
+own_data(RedBlackBST *tree, RedBlackNode *node) {
+    if(tree->copy_func == NULL || !unshare_data(tree, node->data))
+        return;
+    node->data = tree->copy_func(node->data);
+    if(tree->get_id_func)
+        index_put(tree, node->data);
+}
+
+static void
+release_data(RedBlackBST *tree, void *data) {
+    if(!unshare_data(tree, data))
+        tree->free_func(data);
+}
+
+static size_t
+get_height(RedBlackNode *node) {
+    if(node == NULL)
+        return 0;
+    size_t left_height = get_height(node->left);
+    size_t right_height = get_height(node->right);
+    return (left_height > right_height ? left_height : right_height) + 1;
+}
+
+#ifdef REDBLACK_STATS
+static uint64_t
+stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+stats_record(RedBlackBST *tree, RedBlackOp op, uint64_t start_ns) {
+    uint64_t ns = stats_now() - start_ns;
+    int bucket = ns > 1 ? 63 - __builtin_clzll(ns) : 0;
+    if(bucket >= REDBLACK_STATS_BUCKET_NUM)
+        bucket = REDBLACK_STATS_BUCKET_NUM - 1;
+    STATS_ADD(tree, latency[op][bucket], 1);
+}
+#endif
+
+/* the B-tree and compact backends keep the items themselves, leaving root and the node pool unused */
+static bool
+uses_backend(RedBlackBST *tree) {
+    return tree->btree || tree->compact;
+}
+
+static void
+backend_free(RedBlackBST *tree) {
+    if(tree->btree)
+        redblack_btree_free(tree->btree);
+    else
+        redblack_compact_free(tree->compact);
+}
+
+static bool
+backend_insert(RedBlackBST *tree, void *data) {
+    if(tree->btree)
+        return redblack_btree_insert(tree->btree, data);
+    return redblack_compact_insert(tree->compact, data);
+}
+
+static bool
+backend_remove(RedBlackBST *tree, void *data, void **removed_data) {
+    if(tree->btree)
+        return redblack_btree_remove(tree->btree, data, removed_data);
+    return redblack_compact_remove(tree->compact, data, removed_data);
+}
+
+static void *
+backend_get(RedBlackBST *tree, void *data) {
+    if(tree->btree)
+        return redblack_btree_get(tree->btree, data);
+    return redblack_compact_get(tree->compact, data);
+}
+
+static void *
+backend_get_by_rank(RedBlackBST *tree, size_t rank) {
+    if(tree->btree)
+        return redblack_btree_get_by_rank(tree->btree, rank);
+    return redblack_compact_get_by_rank(tree->compact, rank);
+}
+
+static size_t
+backend_count_less(RedBlackBST *tree, void *data, bool *found) {
+    if(tree->btree)
+        return redblack_btree_count_less(tree->btree, data, found);
+    return redblack_compact_count_less(tree->compact, data, found);
+}
+
+static size_t
+backend_count_by_score(RedBlackBST *tree, void *data, CmpScoreFunc cmp_score_func, bool inclusive) {
+    if(tree->btree)
+        return redblack_btree_count_by_score(tree->btree, data, cmp_score_func, inclusive);
+    return redblack_compact_count_by_score(tree->compact, data, cmp_score_func, inclusive);
+}
+
+static void
+backend_get_range_by_rank(RedBlackBST *tree, size_t start_rank, size_t end_rank, TraverseRangeFunc func) {
+    if(tree->btree)
+        redblack_btree_get_range_by_rank(tree->btree, start_rank, end_rank, func);
+    else
+        redblack_compact_get_range_by_rank(tree->compact, start_rank, end_rank, func);
+}
+
+static size_t
+backend_get_extremes(RedBlackBST *tree, size_t n, void **items, bool from_max) {
+    if(tree->btree)
+        return redblack_btree_get_extremes(tree->btree, n, items, from_max);
+    return redblack_compact_get_extremes(tree->compact, n, items, from_max);
+}
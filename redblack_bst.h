@@ -4,8 +4,11 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#define REDBLACK_MAX_HEIGHT 128
+
 typedef struct redblack_bst RedBlackBST;
 typedef struct redblack_node RedBlackNode;
+typedef struct redblack_reclaimer RedBlackReclaimer;
 
 typedef int (*CmpFunc)(void *data1, void *data2);
 typedef void (*UpdateFunc)(void *data1, void *data2);
@@ -13,11 +16,102 @@ typedef void (*FreeFunc)(void *data);
 typedef const char *(*GetDrawStrFunc)(RedBlackNode *node);
 typedef void (*TraverseRangeFunc)(void *data);
 typedef int (*CmpScoreFunc)(void *min_data, void *max_data);
+typedef uint64_t (*GetIdFunc)(void *data);
+typedef void *(*CopyFunc)(void *data);
+typedef uint64_t (*GetKeyFunc)(void *data);
+/* sets aggregate to the combination, in order, of left, data and right, where left and right are the
+ * aggregates of the neighbouring items or NULL when there are none */
+typedef void (*AggregateFunc)(void *aggregate, void *data, const void *left, const void *right);
+
+typedef enum {
+    REDBLACK_OP_INSERT,
+    REDBLACK_OP_DELETE,
+    REDBLACK_OP_UPDATE,
+    REDBLACK_OP_GET,
+    REDBLACK_OP_RANK,
+    REDBLACK_OP_RANGE,
+    REDBLACK_OP_NUM,
+} RedBlackOp;
+
+#define REDBLACK_STATS_BUCKET_NUM 32
+
+/* counters and latencies are only collected when built with -DREDBLACK_STATS; latency[op][i] counts
+ * calls that took [2^i, 2^(i+1)) ns, the last bucket taking everything slower. black_height is measured
+ * on every call in O(log n) and max_height is the 2 * black_height bound the colors put on the height;
+ * both are zero for the B-tree and compact backends */
+typedef struct {
+    uint64_t cmp_num;
+    uint64_t rotate_left_num;
+    uint64_t rotate_right_num;
+    uint64_t flip_num;
+    uint64_t alloc_num;
+    size_t max_height;
+    size_t black_height;
+    uint64_t latency[REDBLACK_OP_NUM][REDBLACK_STATS_BUCKET_NUM];
+} RedBlackStats;
+
+typedef struct {
+    size_t slab_num;
+    size_t live_node_num;
+    size_t free_node_num;
+} RedBlackPoolStats;
+
+/* a cursor holds the path from the root to its element and is invalidated by any modification */
+typedef struct {
+    RedBlackBST *tree;
+    RedBlackNode *path[REDBLACK_MAX_HEIGHT];
+    int depth;
+    size_t rank;
+} RedBlackCursor;
 
 RedBlackBST *redblack_new(CmpFunc cmp_func, UpdateFunc update_func,
     FreeFunc free_func, GetDrawStrFunc get_draw_str_func);
+RedBlackBST *redblack_new_with_pool(CmpFunc cmp_func, UpdateFunc update_func,
+    FreeFunc free_func, GetDrawStrFunc get_draw_str_func, size_t slab_node_num);
+/* a B-tree backed container for large trees; cursors, snapshots, split, join, union and the node accessors
+ * are not supported */
+RedBlackBST *redblack_new_btree(CmpFunc cmp_func, UpdateFunc update_func,
+    FreeFunc free_func, GetKeyFunc get_key_func);
+/* a red-black tree of 12-byte nodes addressed by 32-bit indices, with the color packed into the subtree
+ * count, holding up to 2^31 - 1 items; it has the restrictions of the B-tree backend */
+RedBlackBST *redblack_new_compact(CmpFunc cmp_func, UpdateFunc update_func, FreeFunc free_func);
+/* free_func may be NULL for trees that do not own their items, in which case freeing a tree that alone uses
+ * its slab pool only frees the slabs */
 void redblack_free(RedBlackBST *tree);
+/* free_deferred detaches a tree in O(1) and leaves its nodes to the reclaimer. without a background thread
+ * they are freed by reclaim calls, max_node_num at a time, on the thread that modifies the trees sharing
+ * their pool, reclaim returning false once nothing is left; B-tree and compact trees go in one call. a
+ * background reclaimer frees a tree with its own pool and no snapshots on its own thread, calling free_func
+ * there, and frees other trees at once. freeing the reclaimer finishes its work */
+RedBlackReclaimer *redblack_reclaimer_new(bool background);
+void redblack_reclaimer_free(RedBlackReclaimer *reclaimer);
+void redblack_free_deferred(RedBlackReclaimer *reclaimer, RedBlackBST *tree);
+bool redblack_reclaim(RedBlackReclaimer *reclaimer, size_t max_node_num);
+void redblack_get_pool_stats(RedBlackBST *tree, RedBlackPoolStats *stats);
+void redblack_get_stats(RedBlackBST *tree, RedBlackStats *stats);
+/* walks every node, so unlike get_stats it is meant for debugging rather than periodic export */
+size_t redblack_get_height(RedBlackBST *tree);
+void redblack_reset_stats(RedBlackBST *tree);
+/* snapshots are read-only and taken on the writer's thread; any thread may free one, and its nodes are
+ * reclaimed by the writer's next modification. the tree needs a copy_func, which copies an item still seen
+ * by a snapshot before the tree changes it in place or hands it to the caller */
+RedBlackBST *redblack_snapshot(RedBlackBST *tree);
+void redblack_set_copy_func(RedBlackBST *tree, CopyFunc copy_func);
+void redblack_set_id_func(RedBlackBST *tree, GetIdFunc get_id_func);
+/* the key is kept inline in each node and compared before cmp_func, so it must order items as cmp_func does */
+void redblack_set_key_func(RedBlackBST *tree, GetKeyFunc get_key_func);
+/* keeps an aggregate_size byte aggregate of every subtree in its root node; must be set before the first
+ * insert and is not supported by the B-tree backend */
+void redblack_set_aggregate_func(RedBlackBST *tree, AggregateFunc aggregate_func, size_t aggregate_size);
+void *redblack_get_by_id(RedBlackBST *tree, uint64_t id);
+bool redblack_update_key(RedBlackBST *tree, void *data);
 void redblack_insert(RedBlackBST *tree, void *data);
+void redblack_build_sorted(RedBlackBST *tree, void **items, size_t n);
+void redblack_insert_batch(RedBlackBST *tree, void **items, size_t n);
+/* upsert_batch needs an id func and takes ownership of items, whose ids must be distinct: an item whose id is
+ * in the tree is passed to update_func for the stored item and freed, the others are inserted. large
+ * batches are merged with the tree in one pass and rebuilt */
+void redblack_upsert_batch(RedBlackBST *tree, void **items, size_t n);
 void *redblack_get(RedBlackBST *tree, void *data);
 void *redblack_get_min(RedBlackBST *tree);
 void *redblack_get_max(RedBlackBST *tree);
@@ -30,13 +124,64 @@ const char *redblack_get_draw_str(RedBlackBST *tree, RedBlackNode *node);
 size_t redblack_get_sub_node_num(RedBlackNode *node);
 bool redblack_is_red(RedBlackNode *node);
 bool redblack_is_empty(RedBlackBST *tree);
+size_t redblack_get_node_num(RedBlackBST *tree);
+FreeFunc redblack_get_free_func(RedBlackBST *tree);
 void redblack_delete_min(RedBlackBST *tree);
 void redblack_delete_max(RedBlackBST *tree);
-void redblack_delete(RedBlackBST *tree, void *data);
+bool redblack_delete(RedBlackBST *tree, void *data);
+/* remove hands the item to the caller instead of free_func, or a copy of it while a snapshot still sees it */
+bool redblack_remove(RedBlackBST *tree, void *data, void **removed_data);
 void *redblack_get_by_rank(RedBlackBST *tree, size_t rank);
+size_t redblack_rank_of(RedBlackBST *tree, void *data);
+size_t redblack_count_less(RedBlackBST *tree, void *data);
+size_t redblack_count_less_by_score(RedBlackBST *tree, void *data, CmpScoreFunc cmp_score_func);
+size_t redblack_count_in_score_range(RedBlackBST *tree,
+    void *min_data, void *max_data, CmpScoreFunc cmp_score_func);
+/* quantile returns the item ranked ceil(q * n), at least 1, or NULL when the tree is empty */
+void *redblack_quantile(RedBlackBST *tree, double q);
+/* histogram splits the items at k ascending boundaries into k + 1 buckets, counts[i] taking the number of
+ * items scoring at least boundaries[i - 1] and less than boundaries[i] */
+void redblack_histogram(RedBlackBST *tree, void **boundaries, size_t k,
+    CmpScoreFunc cmp_score_func, size_t *counts);
 void redblack_get_range_by_score(RedBlackBST *tree,
     void *min_data, void *max_data, TraverseRangeFunc func, CmpScoreFunc cmp_score_func);
 void redblack_get_range_by_rank(RedBlackBST *tree,
     size_t start_rank, size_t end_rank, TraverseRangeFunc func);
+/* the aggregate functions store the aggregate of the items in the range into aggregate in O(log n), returning
+ * false and leaving it untouched when the range is empty; ranks outside the tree are clamped */
+bool redblack_aggregate_by_rank(RedBlackBST *tree, size_t start_rank, size_t end_rank, void *aggregate);
+bool redblack_aggregate_by_score(RedBlackBST *tree, void *min_data, void *max_data,
+    CmpScoreFunc cmp_score_func, void *aggregate);
+/* top_n and bottom_n copy up to n items into items, largest or smallest first, and return the count;
+ * pop_max_n and pop_min_n also detach those items and hand them to the caller instead of free_func, as
+ * copies for the items a snapshot still sees */
+size_t redblack_top_n(RedBlackBST *tree, size_t n, void **items);
+size_t redblack_bottom_n(RedBlackBST *tree, size_t n, void **items);
+size_t redblack_pop_max_n(RedBlackBST *tree, size_t n, void **items);
+size_t redblack_pop_min_n(RedBlackBST *tree, size_t n, void **items);
+/* the delete_range functions remove the items in the range, ranks outside the tree being clamped, by
+ * splitting it at both ends and joining the outer parts in O(log n), then free them; they return the count */
+size_t redblack_delete_range_by_rank(RedBlackBST *tree, size_t start_rank, size_t end_rank);
+size_t redblack_delete_range_by_score(RedBlackBST *tree, void *min_data, void *max_data,
+    CmpScoreFunc cmp_score_func);
+/* split leaves the items ordering before data in tree, which is also stored in left, and moves the rest to
+ * a new tree stored in right; the two share a node pool and must be modified from the same thread */
+void redblack_split(RedBlackBST *tree, void *data, RedBlackBST **left, RedBlackBST **right);
+/* join and union consume right or other; every item of left must order before every item of right, and
+ * union keeps tree's copy of an item present in both after passing other's to update_func. a tree from
+ * another pool must have no live snapshots, and both trees must use the same aggregate */
+void redblack_join(RedBlackBST *left, RedBlackBST *right);
+void redblack_union(RedBlackBST *tree, RedBlackBST *other);
+void redblack_cursor_init(RedBlackCursor *cursor, RedBlackBST *tree);
+bool redblack_cursor_seek_first(RedBlackCursor *cursor);
+bool redblack_cursor_seek_last(RedBlackCursor *cursor);
+bool redblack_cursor_seek(RedBlackCursor *cursor, void *data);
+bool redblack_cursor_seek_by_score(RedBlackCursor *cursor, void *data, CmpScoreFunc cmp_score_func);
+bool redblack_cursor_seek_by_rank(RedBlackCursor *cursor, size_t rank);
+bool redblack_cursor_next(RedBlackCursor *cursor);
+bool redblack_cursor_prev(RedBlackCursor *cursor);
+bool redblack_cursor_is_valid(RedBlackCursor *cursor);
+void *redblack_cursor_get(RedBlackCursor *cursor);
+size_t redblack_cursor_get_rank(RedBlackCursor *cursor);
 
 #endif
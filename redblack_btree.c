@@ -0,0 +1,614 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+#include "redblack_btree.h"
+
+#define NODE_MAX 32
+#define NODE_MIN (NODE_MAX / 2)
+#define CACHE_LINE_SIZE 64
+#define KEY_PAD UINT64_MAX
+
+/* a leaf holds num items; an inner node holds num children and the num - 1 separators between them,
+ * separator i being the smallest item under child i + 1; unused keys are padded with KEY_PAD */
+typedef struct btree_node {
+    uint64_t keys[NODE_MAX];
+    void *items[NODE_MAX];
+    int num;
+    bool leaf;
+} BTreeNode;
+
+typedef struct {
+    BTreeNode node;
+    BTreeNode *children[NODE_MAX];
+    size_t counts[NODE_MAX];
+} BTreeInner;
+
+struct redblack_btree {
+    BTreeNode *root;
+    size_t item_num;
+    CmpFunc cmp_func;
+    UpdateFunc update_func;
+    FreeFunc free_func;
+    GetKeyFunc get_key_func;
+};
+
+static BTreeNode *node_new(bool leaf);
+static void node_free(RedBlackBTree *btree, BTreeNode *node);
+static BTreeInner *to_inner(BTreeNode *node);
+static size_t node_size(BTreeNode *node);
+static uint64_t get_key(RedBlackBTree *btree, void *data);
+static int count_less_keys(const uint64_t *keys, uint64_t key);
+static int search(RedBlackBTree *btree, BTreeNode *node, int key_num, void *data, uint64_t key, bool *found);
+static int child_index(RedBlackBTree *btree, BTreeNode *node, void *data, uint64_t key, bool *found);
+static void put_key(BTreeNode *node, int pos, int key_num, uint64_t key, void *item);
+static void cut_key(BTreeNode *node, int pos, int key_num);
+static void put_child(BTreeInner *parent, int index, BTreeNode *child, size_t count);
+static void cut_child(BTreeInner *parent, int index);
+static BTreeNode *insert_node(RedBlackBTree *btree, BTreeNode *node, void *data, uint64_t key,
+    bool *inserted, uint64_t *sep_key, void **sep_item);
+static BTreeNode *split_leaf(BTreeNode *node, int pos, uint64_t key, void *data,
+    uint64_t *sep_key, void **sep_item);
+static BTreeNode *split_inner(BTreeInner *parent, int index, BTreeNode *child, size_t count,
+    uint64_t *sep_key, void **sep_item);
+static bool remove_node(RedBlackBTree *btree, BTreeNode *node, void *data, uint64_t key,
+    void **removed, bool *separator);
+static void fix_underflow(BTreeInner *parent, int index);
+static void merge(BTreeInner *parent, int index);
+static void borrow_from_right(BTreeInner *parent, int index);
+static void borrow_from_left(BTreeInner *parent, int index);
+static void replace_separator(RedBlackBTree *btree, void *data, uint64_t key);
+static int count_prefix(void **items, int n, void *data, CmpScoreFunc cmp_score_func, bool inclusive);
+static void get_range_by_rank(BTreeNode *node, size_t start_rank, size_t end_rank, TraverseRangeFunc func);
+static size_t collect_extremes(BTreeNode *node, size_t n, void **items, bool from_max);
+
+RedBlackBTree *
+redblack_btree_new(CmpFunc cmp_func, UpdateFunc update_func,
+        FreeFunc free_func, GetKeyFunc get_key_func) {
+    RedBlackBTree *btree = malloc(sizeof(*btree));
+    btree->root = node_new(true);
+    btree->item_num = 0;
+    btree->cmp_func = cmp_func;
+    btree->update_func = update_func;
+    btree->free_func = free_func;
+    btree->get_key_func = get_key_func;
+    return btree;
+}
+
+void
+redblack_btree_free(RedBlackBTree *btree) {
+    node_free(btree, btree->root);
+    free(btree);
+}
+
+size_t
+redblack_btree_size(RedBlackBTree *btree) {
+    return btree->item_num;
+}
+
+bool
+redblack_btree_insert(RedBlackBTree *btree, void *data) {
+    bool inserted = false;
+    uint64_t sep_key;
+    void *sep_item;
+    BTreeNode *split = insert_node(btree, btree->root, data, get_key(btree, data),
+        &inserted, &sep_key, &sep_item);
+    if(split) {
+        BTreeInner *root = (BTreeInner *)node_new(false);
+        root->children[0] = btree->root;
+        root->counts[0] = node_size(btree->root);
+        root->node.num = 1;
+        put_child(root, 1, split, node_size(split));
+        put_key(&root->node, 0, 0, sep_key, sep_item);
+        btree->root = &root->node;
+    }
+    if(inserted)
+        btree->item_num++;
+    return inserted;
+}
+
+bool
+redblack_btree_remove(RedBlackBTree *btree, void *data, void **removed_data) {
+    uint64_t key = get_key(btree, data);
+    void *removed = NULL;
+    bool separator = false;
+    if(!remove_node(btree, btree->root, data, key, &removed, &separator))
+        return false;
+    btree->item_num--;
+    if(!btree->root->leaf && btree->root->num == 1) {
+        BTreeNode *root = btree->root;
+        btree->root = to_inner(root)->children[0];
+        free(root);
+    }
+    if(separator)
+        replace_separator(btree, data, key);
+    if(removed_data)
+        *removed_data = removed;
+    else
+        btree->free_func(removed);
+    return true;
+}
+
+void *
+redblack_btree_get(RedBlackBTree *btree, void *data) {
+    uint64_t key = get_key(btree, data);
+    BTreeNode *node = btree->root;
+    bool found;
+    while(!node->leaf)
+        node = to_inner(node)->children[child_index(btree, node, data, key, &found)];
+    int pos = search(btree, node, node->num, data, key, &found);
+    return found ? node->items[pos] : NULL;
+}
+
+void *
+redblack_btree_get_by_rank(RedBlackBTree *btree, size_t rank) {
+    if(rank < 1 || rank > btree->item_num)
+        return NULL;
+    BTreeNode *node = btree->root;
+    while(!node->leaf) {
+        BTreeInner *parent = to_inner(node);
+        int i = 0;
+        while(rank > parent->counts[i])
+            rank -= parent->counts[i++];
+        node = parent->children[i];
+    }
+    return node->items[rank - 1];
+}
+
+size_t
+redblack_btree_count_less(RedBlackBTree *btree, void *data, bool *found) {
+    uint64_t key = get_key(btree, data);
+    BTreeNode *node = btree->root;
+    size_t less_num = 0;
+    while(!node->leaf) {
+        BTreeInner *parent = to_inner(node);
+        int index = child_index(btree, node, data, key, found);
+        for(int i = 0;i < index;i++)
+            less_num += parent->counts[i];
+        node = parent->children[index];
+    }
+    return less_num + search(btree, node, node->num, data, key, found);
+}
+
+size_t
+redblack_btree_count_by_score(RedBlackBTree *btree, void *data,
+        CmpScoreFunc cmp_score_func, bool inclusive) {
+    BTreeNode *node = btree->root;
+    size_t num = 0;
+    while(!node->leaf) {
+        BTreeInner *parent = to_inner(node);
+        int index = count_prefix(node->items, node->num - 1, data, cmp_score_func, inclusive);
+        for(int i = 0;i < index;i++)
+            num += parent->counts[i];
+        node = parent->children[index];
+    }
+    return num + count_prefix(node->items, node->num, data, cmp_score_func, inclusive);
+}
+
+void
+redblack_btree_get_range_by_rank(RedBlackBTree *btree,
+        size_t start_rank, size_t end_rank, TraverseRangeFunc func) {
+    if(end_rank > btree->item_num)
+        end_rank = btree->item_num;
+    if(start_rank < 1)
+        start_rank = 1;
+    if(start_rank <= end_rank)
+        get_range_by_rank(btree->root, start_rank, end_rank, func);
+}
+
+size_t
+redblack_btree_get_extremes(RedBlackBTree *btree, size_t n, void **items, bool from_max) {
+    return collect_extremes(btree->root, n, items, from_max);
+}
+
+static BTreeNode *
+node_new(bool leaf) {
+    void *memory;
+    if(posix_memalign(&memory, CACHE_LINE_SIZE, leaf ? sizeof(BTreeNode) : sizeof(BTreeInner)) != 0)
+        abort();
+    BTreeNode *node = memory;
+    for(int i = 0;i < NODE_MAX;i++)
+        node->keys[i] = KEY_PAD;
+    node->num = 0;
+    node->leaf = leaf;
+    return node;
+}
+
+static void
+node_free(RedBlackBTree *btree, BTreeNode *node) {
+    if(node->leaf) {
+        for(int i = 0;i < node->num;i++)
+            btree->free_func(node->items[i]);
+    }
+    else {
+        for(int i = 0;i < node->num;i++)
+            node_free(btree, to_inner(node)->children[i]);
+    }
+    free(node);
+}
+
+static BTreeInner *
+to_inner(BTreeNode *node) {
+    return (BTreeInner *)node;
+}
+
+static size_t
+node_size(BTreeNode *node) {
+    if(node->leaf)
+        return node->num;
+    size_t size = 0;
+    for(int i = 0;i < node->num;i++)
+        size += to_inner(node)->counts[i];
+    return size;
+}
+
+static uint64_t
+get_key(RedBlackBTree *btree, void *data) {
+    return btree->get_key_func ? btree->get_key_func(data) : 0;
+}
+
+static int
+count_less_keys(const uint64_t *keys, uint64_t key) {
+    int num = 0;
+#if defined(__AVX2__)
+    __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    __m256i target = _mm256_xor_si256(_mm256_set1_epi64x((long long)key), sign);
+    for(int i = 0;i < NODE_MAX;i += 4) {
+        __m256i value = _mm256_xor_si256(_mm256_load_si256((const __m256i *)(keys + i)), sign);
+        __m256i less = _mm256_cmpgt_epi64(target, value);
+        num += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(less)));
+    }
+#elif defined(__SSE4_2__)
+    __m128i sign = _mm_set1_epi64x(INT64_MIN);
+    __m128i target = _mm_xor_si128(_mm_set1_epi64x((long long)key), sign);
+    for(int i = 0;i < NODE_MAX;i += 2) {
+        __m128i value = _mm_xor_si128(_mm_load_si128((const __m128i *)(keys + i)), sign);
+        __m128i less = _mm_cmpgt_epi64(target, value);
+        num += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(less)));
+    }
+#else
+    for(int i = 0;i < NODE_MAX;i++)
+        num += keys[i] < key;
+#endif
+    return num;
+}
+
+static int
+search(RedBlackBTree *btree, BTreeNode *node, int key_num, void *data, uint64_t key, bool *found) {
+    int low = count_less_keys(node->keys, key);
+    int high = low;
+    while(high < key_num && node->keys[high] == key)
+        high++;
+    *found = false;
+    while(low < high) {
+        int mid = (low + high) / 2;
+        int result = btree->cmp_func(data, node->items[mid]);
+        if(result == 0) {
+            *found = true;
+            return mid;
+        }
+        if(result > 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+static int
+child_index(RedBlackBTree *btree, BTreeNode *node, void *data, uint64_t key, bool *found) {
+    int pos = search(btree, node, node->num - 1, data, key, found);
+    return *found ? pos + 1 : pos;
+}
+
+static void
+put_key(BTreeNode *node, int pos, int key_num, uint64_t key, void *item) {
+    memmove(&node->keys[pos + 1], &node->keys[pos], (key_num - pos) * sizeof(node->keys[0]));
+    memmove(&node->items[pos + 1], &node->items[pos], (key_num - pos) * sizeof(node->items[0]));
+    node->keys[pos] = key;
+    node->items[pos] = item;
+}
+
+static void
+cut_key(BTreeNode *node, int pos, int key_num) {
+    memmove(&node->keys[pos], &node->keys[pos + 1], (key_num - pos - 1) * sizeof(node->keys[0]));
+    memmove(&node->items[pos], &node->items[pos + 1], (key_num - pos - 1) * sizeof(node->items[0]));
+    node->keys[key_num - 1] = KEY_PAD;
+}
+
+static void
+put_child(BTreeInner *parent, int index, BTreeNode *child, size_t count) {
+    int num = parent->node.num;
+    memmove(&parent->children[index + 1], &parent->children[index], (num - index) * sizeof(parent->children[0]));
+    memmove(&parent->counts[index + 1], &parent->counts[index], (num - index) * sizeof(parent->counts[0]));
+    parent->children[index] = child;
+    parent->counts[index] = count;
+    parent->node.num++;
+}
+
+static void
+cut_child(BTreeInner *parent, int index) {
+    int num = parent->node.num;
+    memmove(&parent->children[index], &parent->children[index + 1], (num - index - 1) * sizeof(parent->children[0]));
+    memmove(&parent->counts[index], &parent->counts[index + 1], (num - index - 1) * sizeof(parent->counts[0]));
+    parent->node.num--;
+}
+
+static BTreeNode *
+insert_node(RedBlackBTree *btree, BTreeNode *node, void *data, uint64_t key,
+        bool *inserted, uint64_t *sep_key, void **sep_item) {
+    bool found;
+    if(node->leaf) {
+        int pos = search(btree, node, node->num, data, key, &found);
+        if(found) {
+            btree->update_func(node->items[pos], data);
+            node->keys[pos] = get_key(btree, node->items[pos]);
+            return NULL;
+        }
+        *inserted = true;
+        if(node->num < NODE_MAX) {
+            put_key(node, pos, node->num, key, data);
+            node->num++;
+            return NULL;
+        }
+        return split_leaf(node, pos, key, data, sep_key, sep_item);
+    }
+    BTreeInner *parent = to_inner(node);
+    int index = child_index(btree, node, data, key, &found);
+    BTreeNode *split = insert_node(btree, parent->children[index], data, key, inserted, sep_key, sep_item);
+    if(*inserted)
+        parent->counts[index]++;
+    if(split == NULL)
+        return NULL;
+    size_t split_count = node_size(split);
+    parent->counts[index] -= split_count;
+    if(node->num < NODE_MAX) {
+        put_key(node, index, node->num - 1, *sep_key, *sep_item);
+        put_child(parent, index + 1, split, split_count);
+        return NULL;
+    }
+    return split_inner(parent, index + 1, split, split_count, sep_key, sep_item);
+}
+
+static BTreeNode *
+split_leaf(BTreeNode *node, int pos, uint64_t key, void *data,
+        uint64_t *sep_key, void **sep_item) {
+    int half = NODE_MAX / 2;
+    BTreeNode *right = node_new(true);
+    memcpy(right->keys, &node->keys[half], (NODE_MAX - half) * sizeof(node->keys[0]));
+    memcpy(right->items, &node->items[half], (NODE_MAX - half) * sizeof(node->items[0]));
+    for(int i = half;i < NODE_MAX;i++)
+        node->keys[i] = KEY_PAD;
+    right->num = NODE_MAX - half;
+    node->num = half;
+    BTreeNode *target = pos <= half ? node : right;
+    if(target == right)
+        pos -= half;
+    put_key(target, pos, target->num, key, data);
+    target->num++;
+    *sep_key = right->keys[0];
+    *sep_item = right->items[0];
+    return right;
+}
+
+static BTreeNode *
+split_inner(BTreeInner *parent, int index, BTreeNode *child, size_t count,
+        uint64_t *sep_key, void **sep_item) {
+    int half = NODE_MAX / 2;
+    BTreeNode *node = &parent->node;
+    BTreeInner *right = (BTreeInner *)node_new(false);
+    uint64_t up_key = node->keys[half - 1];
+    void *up_item = node->items[half - 1];
+    memcpy(right->node.keys, &node->keys[half], (NODE_MAX - 1 - half) * sizeof(node->keys[0]));
+    memcpy(right->node.items, &node->items[half], (NODE_MAX - 1 - half) * sizeof(node->items[0]));
+    memcpy(right->children, &parent->children[half], (NODE_MAX - half) * sizeof(parent->children[0]));
+    memcpy(right->counts, &parent->counts[half], (NODE_MAX - half) * sizeof(parent->counts[0]));
+    for(int i = half - 1;i < NODE_MAX;i++)
+        node->keys[i] = KEY_PAD;
+    right->node.num = NODE_MAX - half;
+    node->num = half;
+    if(index <= half) {
+        put_key(node, index - 1, node->num - 1, *sep_key, *sep_item);
+        put_child(parent, index, child, count);
+    }
+    else {
+        put_key(&right->node, index - half - 1, right->node.num - 1, *sep_key, *sep_item);
+        put_child(right, index - half, child, count);
+    }
+    *sep_key = up_key;
+    *sep_item = up_item;
+    return &right->node;
+}
+
+static bool
+remove_node(RedBlackBTree *btree, BTreeNode *node, void *data, uint64_t key,
+        void **removed, bool *separator) {
+    bool found;
+    if(node->leaf) {
+        int pos = search(btree, node, node->num, data, key, &found);
+        if(!found)
+            return false;
+        *removed = node->items[pos];
+        cut_key(node, pos, node->num);
+        node->num--;
+        return true;
+    }
+    BTreeInner *parent = to_inner(node);
+    int index = child_index(btree, node, data, key, &found);
+    if(found)
+        *separator = true;
+    if(!remove_node(btree, parent->children[index], data, key, removed, separator))
+        return false;
+    parent->counts[index]--;
+    if(parent->children[index]->num < NODE_MIN)
+        fix_underflow(parent, index);
+    return true;
+}
+
+static void
+fix_underflow(BTreeInner *parent, int index) {
+    assert(parent->node.num >= 2);
+    int left_index = index > 0 ? index - 1 : 0;
+    BTreeNode *left = parent->children[left_index];
+    BTreeNode *right = parent->children[left_index + 1];
+    if(left->num + right->num <= NODE_MAX)
+        merge(parent, left_index);
+    else if(index == left_index)
+        borrow_from_right(parent, left_index);
+    else
+        borrow_from_left(parent, left_index);
+}
+
+static void
+merge(BTreeInner *parent, int index) {
+    BTreeNode *left = parent->children[index];
+    BTreeNode *right = parent->children[index + 1];
+    if(left->leaf) {
+        memcpy(&left->keys[left->num], right->keys, right->num * sizeof(left->keys[0]));
+        memcpy(&left->items[left->num], right->items, right->num * sizeof(left->items[0]));
+        left->num += right->num;
+    }
+    else {
+        BTreeInner *left_inner = to_inner(left);
+        BTreeInner *right_inner = to_inner(right);
+        left->keys[left->num - 1] = parent->node.keys[index];
+        left->items[left->num - 1] = parent->node.items[index];
+        memcpy(&left->keys[left->num], right->keys, (right->num - 1) * sizeof(left->keys[0]));
+        memcpy(&left->items[left->num], right->items, (right->num - 1) * sizeof(left->items[0]));
+        memcpy(&left_inner->children[left->num], right_inner->children, right->num * sizeof(left_inner->children[0]));
+        memcpy(&left_inner->counts[left->num], right_inner->counts, right->num * sizeof(left_inner->counts[0]));
+        left->num += right->num;
+    }
+    parent->counts[index] += parent->counts[index + 1];
+    cut_key(&parent->node, index, parent->node.num - 1);
+    cut_child(parent, index + 1);
+    free(right);
+}
+
+static void
+borrow_from_right(BTreeInner *parent, int index) {
+    BTreeNode *left = parent->children[index];
+    BTreeNode *right = parent->children[index + 1];
+    size_t count = 1;
+    if(left->leaf) {
+        left->keys[left->num] = right->keys[0];
+        left->items[left->num] = right->items[0];
+        left->num++;
+        cut_key(right, 0, right->num);
+        right->num--;
+        parent->node.keys[index] = right->keys[0];
+        parent->node.items[index] = right->items[0];
+    }
+    else {
+        BTreeInner *right_inner = to_inner(right);
+        count = right_inner->counts[0];
+        left->keys[left->num - 1] = parent->node.keys[index];
+        left->items[left->num - 1] = parent->node.items[index];
+        to_inner(left)->children[left->num] = right_inner->children[0];
+        to_inner(left)->counts[left->num] = count;
+        left->num++;
+        parent->node.keys[index] = right->keys[0];
+        parent->node.items[index] = right->items[0];
+        cut_key(right, 0, right->num - 1);
+        cut_child(right_inner, 0);
+    }
+    parent->counts[index] += count;
+    parent->counts[index + 1] -= count;
+}
+
+static void
+borrow_from_left(BTreeInner *parent, int index) {
+    BTreeNode *left = parent->children[index];
+    BTreeNode *right = parent->children[index + 1];
+    size_t count = 1;
+    if(left->leaf) {
+        put_key(right, 0, right->num, left->keys[left->num - 1], left->items[left->num - 1]);
+        right->num++;
+        left->num--;
+        left->keys[left->num] = KEY_PAD;
+        parent->node.keys[index] = right->keys[0];
+        parent->node.items[index] = right->items[0];
+    }
+    else {
+        BTreeInner *left_inner = to_inner(left);
+        count = left_inner->counts[left->num - 1];
+        put_key(right, 0, right->num - 1, parent->node.keys[index], parent->node.items[index]);
+        put_child(to_inner(right), 0, left_inner->children[left->num - 1], count);
+        parent->node.keys[index] = left->keys[left->num - 2];
+        parent->node.items[index] = left->items[left->num - 2];
+        left->keys[left->num - 2] = KEY_PAD;
+        left->num--;
+    }
+    parent->counts[index] -= count;
+    parent->counts[index + 1] += count;
+}
+
+static void
+replace_separator(RedBlackBTree *btree, void *data, uint64_t key) {
+    BTreeNode *node = btree->root;
+    bool found;
+    while(!node->leaf) {
+        int pos = search(btree, node, node->num - 1, data, key, &found);
+        if(found) {
+            BTreeNode *min = to_inner(node)->children[pos + 1];
+            while(!min->leaf)
+                min = to_inner(min)->children[0];
+            node->keys[pos] = min->keys[0];
+            node->items[pos] = min->items[0];
+            pos++;
+        }
+        node = to_inner(node)->children[pos];
+    }
+}
+
+static int
+count_prefix(void **items, int n, void *data, CmpScoreFunc cmp_score_func, bool inclusive) {
+    int low = 0;
+    int high = n;
+    while(low < high) {
+        int mid = (low + high) / 2;
+        int result = cmp_score_func(items[mid], data);
+        if(result < 0 || (inclusive && result == 0))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+static void
+get_range_by_rank(BTreeNode *node, size_t start_rank, size_t end_rank, TraverseRangeFunc func) {
+    if(node->leaf) {
+        for(size_t i = start_rank;i <= end_rank;i++)
+            func(node->items[i - 1]);
+        return;
+    }
+    BTreeInner *parent = to_inner(node);
+    size_t base = 0;
+    for(int i = 0;i < node->num && base < end_rank;i++) {
+        size_t count = parent->counts[i];
+        if(base + count >= start_rank)
+            get_range_by_rank(parent->children[i], start_rank > base ? start_rank - base : 1,
+                end_rank - base < count ? end_rank - base : count, func);
+        base += count;
+    }
+}
+
+static size_t
+collect_extremes(BTreeNode *node, size_t n, void **items, bool from_max) {
+    size_t item_num = 0;
+    if(node->leaf) {
+        for(;item_num < n && item_num < (size_t)node->num;item_num++)
+            items[item_num] = node->items[from_max ? node->num - 1 - item_num : item_num];
+        return item_num;
+    }
+    BTreeInner *parent = to_inner(node);
+    for(int i = 0;i < node->num && item_num < n;i++) {
+        BTreeNode *child = parent->children[from_max ? node->num - 1 - i : i];
+        item_num += collect_extremes(child, n - item_num, items + item_num, from_max);
+    }
+    return item_num;
+}
@@ -0,0 +1,22 @@
+#ifndef REDBLACK_BTREE_H
+#define REDBLACK_BTREE_H
+#include "redblack_bst.h"
+
+typedef struct redblack_btree RedBlackBTree;
+
+RedBlackBTree *redblack_btree_new(CmpFunc cmp_func, UpdateFunc update_func,
+    FreeFunc free_func, GetKeyFunc get_key_func);
+void redblack_btree_free(RedBlackBTree *btree);
+size_t redblack_btree_size(RedBlackBTree *btree);
+bool redblack_btree_insert(RedBlackBTree *btree, void *data);
+bool redblack_btree_remove(RedBlackBTree *btree, void *data, void **removed_data);
+void *redblack_btree_get(RedBlackBTree *btree, void *data);
+void *redblack_btree_get_by_rank(RedBlackBTree *btree, size_t rank);
+size_t redblack_btree_count_less(RedBlackBTree *btree, void *data, bool *found);
+size_t redblack_btree_count_by_score(RedBlackBTree *btree, void *data,
+    CmpScoreFunc cmp_score_func, bool inclusive);
+void redblack_btree_get_range_by_rank(RedBlackBTree *btree,
+    size_t start_rank, size_t end_rank, TraverseRangeFunc func);
+size_t redblack_btree_get_extremes(RedBlackBTree *btree, size_t n, void **items, bool from_max);
+
+#endif
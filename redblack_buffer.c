@@ -0,0 +1,106 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include "redblack_buffer.h"
+
+typedef struct {
+    uint64_t id;
+    size_t slot;
+} Pending;
+
+struct redblack_write_buffer {
+    RedBlackBST *tree;
+    GetIdFunc get_id_func;
+    FreeFunc free_func;
+    size_t flush_size;
+    uint64_t flush_interval_ns;
+    uint64_t first_put_ns;
+    void **items;
+    size_t item_num;
+    /* maps an id to its slot in items plus one, zero marking a free entry */
+    Pending *pendings;
+    size_t capacity;
+};
+
+static uint64_t now_ns(void);
+static Pending *find_pending(RedBlackWriteBuffer *buffer, uint64_t id);
+
+RedBlackWriteBuffer *
+redblack_write_buffer_new(RedBlackBST *tree, GetIdFunc get_id_func, FreeFunc free_func,
+        size_t flush_size, uint64_t flush_interval_ns) {
+    assert(flush_size > 0);
+    RedBlackWriteBuffer *buffer = malloc(sizeof(*buffer));
+    buffer->tree = tree;
+    buffer->get_id_func = get_id_func;
+    buffer->free_func = free_func;
+    buffer->flush_size = flush_size;
+    buffer->flush_interval_ns = flush_interval_ns;
+    buffer->first_put_ns = 0;
+    buffer->items = malloc(flush_size * sizeof(*buffer->items));
+    buffer->item_num = 0;
+    buffer->capacity = 16;
+    while(buffer->capacity < flush_size * 2)
+        buffer->capacity *= 2;
+    buffer->pendings = calloc(buffer->capacity, sizeof(*buffer->pendings));
+    return buffer;
+}
+
+void
+redblack_write_buffer_free(RedBlackWriteBuffer *buffer) {
+    redblack_write_buffer_flush(buffer);
+    free(buffer->pendings);
+    free(buffer->items);
+    free(buffer);
+}
+
+void
+redblack_write_buffer_put(RedBlackWriteBuffer *buffer, void *data) {
+    Pending *pending = find_pending(buffer, buffer->get_id_func(data));
+    if(pending->slot) {
+        buffer->free_func(buffer->items[pending->slot - 1]);
+        buffer->items[pending->slot - 1] = data;
+    }
+    else {
+        if(buffer->item_num == 0 && buffer->flush_interval_ns)
+            buffer->first_put_ns = now_ns();
+        pending->id = buffer->get_id_func(data);
+        pending->slot = ++buffer->item_num;
+        buffer->items[buffer->item_num - 1] = data;
+    }
+    if(buffer->item_num == buffer->flush_size
+            || (buffer->flush_interval_ns && now_ns() - buffer->first_put_ns >= buffer->flush_interval_ns))
+        redblack_write_buffer_flush(buffer);
+}
+
+void
+redblack_write_buffer_flush(RedBlackWriteBuffer *buffer) {
+    if(buffer->item_num == 0)
+        return;
+    redblack_upsert_batch(buffer->tree, buffer->items, buffer->item_num);
+    buffer->item_num = 0;
+    memset(buffer->pendings, 0, buffer->capacity * sizeof(*buffer->pendings));
+}
+
+size_t
+redblack_write_buffer_get_pending_num(RedBlackWriteBuffer *buffer) {
+    return buffer->item_num;
+}
+
+static uint64_t
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the table is at most half full, so a probe always ends on the id or a free entry */
+static Pending *
+find_pending(RedBlackWriteBuffer *buffer, uint64_t id) {
+    size_t mask = buffer->capacity - 1;
+    size_t i = (id * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+    while(buffer->pendings[i].slot && buffer->pendings[i].id != id)
+        i = (i + 1) & mask;
+    return &buffer->pendings[i];
+}
@@ -0,0 +1,17 @@
+#ifndef REDBLACK_BUFFER_H
+#define REDBLACK_BUFFER_H
+#include "redblack_bst.h"
+
+typedef struct redblack_write_buffer RedBlackWriteBuffer;
+
+/* collects items for redblack_upsert_batch, a later item replacing a pending one with the same id, which is
+ * freed with free_func. the batch is applied once flush_size ids are pending or flush_interval_ns after
+ * its first item, the interval being checked on each put; pending items are not visible in the tree */
+RedBlackWriteBuffer *redblack_write_buffer_new(RedBlackBST *tree, GetIdFunc get_id_func, FreeFunc free_func,
+    size_t flush_size, uint64_t flush_interval_ns);
+void redblack_write_buffer_free(RedBlackWriteBuffer *buffer);
+void redblack_write_buffer_put(RedBlackWriteBuffer *buffer, void *data);
+void redblack_write_buffer_flush(RedBlackWriteBuffer *buffer);
+size_t redblack_write_buffer_get_pending_num(RedBlackWriteBuffer *buffer);
+
+#endif
@@ -0,0 +1,484 @@
+#include <stdlib.h>
+#include <assert.h>
+#include "redblack_compact.h"
+
+#define NIL 0
+#define RED_BIT 0x80000000u
+#define MAX_CAPACITY RED_BIT
+#define MIN_CAPACITY 16
+
+/* a left-leaning red-black tree addressed by 32-bit indices into one array, index 0 standing for no node.
+ * count holds the size of the subtree with the color in its high bit, a freed node links to the next free
+ * one through left, and the data of node i sits in datas[i] so a node takes 12 bytes */
+typedef struct {
+    uint32_t left;
+    uint32_t right;
+    uint32_t count;
+} CompactNode;
+
+struct redblack_compact {
+    CompactNode *nodes;
+    void **datas;
+    uint32_t root;
+    uint32_t free_list;
+    uint32_t used_num;
+    uint32_t capacity;
+    size_t item_num;
+    CmpFunc cmp_func;
+    UpdateFunc update_func;
+    FreeFunc free_func;
+};
+
+static void reserve(RedBlackCompact *compact);
+static uint32_t node_new(RedBlackCompact *compact, void *data);
+static void node_release(RedBlackCompact *compact, uint32_t node);
+static void free_datas(RedBlackCompact *compact, uint32_t node);
+static bool is_red(RedBlackCompact *compact, uint32_t node);
+static void set_red(RedBlackCompact *compact, uint32_t node, bool red);
+static size_t get_count(RedBlackCompact *compact, uint32_t node);
+static void update_count(RedBlackCompact *compact, uint32_t node);
+static uint32_t rotate_left(RedBlackCompact *compact, uint32_t node);
+static uint32_t rotate_right(RedBlackCompact *compact, uint32_t node);
+static void flip_colors(RedBlackCompact *compact, uint32_t node);
+static uint32_t balance(RedBlackCompact *compact, uint32_t node);
+static uint32_t rebalance(RedBlackCompact *compact, uint32_t node, bool *changed);
+static uint32_t unwind(RedBlackCompact *compact, uint32_t *path, bool *dirs, int depth, uint32_t node);
+static uint32_t move_red_left(RedBlackCompact *compact, uint32_t node);
+static uint32_t move_red_right(RedBlackCompact *compact, uint32_t node);
+static uint32_t find(RedBlackCompact *compact, void *data);
+static void get_range_by_rank(RedBlackCompact *compact, uint32_t node,
+    size_t start_rank, size_t end_rank, size_t left_rank, TraverseRangeFunc func);
+
+RedBlackCompact *
+redblack_compact_new(CmpFunc cmp_func, UpdateFunc update_func, FreeFunc free_func) {
+    RedBlackCompact *compact = malloc(sizeof(*compact));
+    compact->nodes = NULL;
+    compact->datas = NULL;
+    compact->root = NIL;
+    compact->free_list = NIL;
+    compact->used_num = 1;
+    compact->capacity = 0;
+    compact->item_num = 0;
+    compact->cmp_func = cmp_func;
+    compact->update_func = update_func;
+    compact->free_func = free_func;
+    return compact;
+}
+
+void
+redblack_compact_free(RedBlackCompact *compact) {
+    free_datas(compact, compact->root);
+    free(compact->nodes);
+    free(compact->datas);
+    free(compact);
+}
+
+size_t
+redblack_compact_size(RedBlackCompact *compact) {
+    return compact->item_num;
+}
+
+/* both descend once, saving the path, and rebalance it on the way back up as the main tree does */
+bool
+redblack_compact_insert(RedBlackCompact *compact, void *data) {
+    uint32_t path[REDBLACK_MAX_HEIGHT];
+    bool dirs[REDBLACK_MAX_HEIGHT];
+    int depth = 0;
+    /* the arrays are grown up front, as nodes are held by index across the descent but not by address */
+    reserve(compact);
+    uint32_t node = compact->root;
+    while(node != NIL) {
+        int result = compact->cmp_func(data, compact->datas[node]);
+        if(result == 0) {
+            compact->update_func(compact->datas[node], data);
+            return false;
+        }
+        path[depth] = node;
+        dirs[depth++] = result > 0;
+        node = result > 0 ? compact->nodes[node].right : compact->nodes[node].left;
+    }
+    node = node_new(compact, data);
+    compact->item_num++;
+    /* once two consecutive levels need no rotation or flip, nothing above them can change */
+    int quiet_num = 0;
+    while(depth > 0) {
+        uint32_t parent = path[--depth];
+        if(quiet_num >= 2) {
+            compact->nodes[parent].count++;
+            continue;
+        }
+        if(dirs[depth])
+            compact->nodes[parent].right = node;
+        else
+            compact->nodes[parent].left = node;
+        bool changed;
+        node = rebalance(compact, parent, &changed);
+        quiet_num = changed ? 0 : quiet_num + 1;
+    }
+    if(quiet_num < 2)
+        compact->root = node;
+    set_red(compact, compact->root, false);
+    return true;
+}
+
+bool
+redblack_compact_remove(RedBlackCompact *compact, void *data, void **removed_data) {
+    uint32_t path[REDBLACK_MAX_HEIGHT];
+    bool dirs[REDBLACK_MAX_HEIGHT];
+    int depth = 0;
+    uint32_t node = compact->root;
+    if(node == NIL)
+        return false;
+    if(!is_red(compact, compact->nodes[node].left) && !is_red(compact, compact->nodes[node].right))
+        set_red(compact, node, true);
+    void *removed = NULL;
+    bool found = false;
+    for(;;) {
+        int result = compact->cmp_func(data, compact->datas[node]);
+        if(result < 0) {
+            uint32_t left = compact->nodes[node].left;
+            if(left == NIL) {
+                node = balance(compact, node);
+                break;
+            }
+            if(!is_red(compact, left) && !is_red(compact, compact->nodes[left].left))
+                node = move_red_left(compact, node);
+            path[depth] = node;
+            dirs[depth++] = false;
+            node = compact->nodes[node].left;
+            continue;
+        }
+        if(is_red(compact, compact->nodes[node].left)) {
+            node = rotate_right(compact, node);
+            result = 1;
+        }
+        uint32_t right = compact->nodes[node].right;
+        if(right == NIL) {
+            if(result != 0) {
+                node = balance(compact, node);
+                break;
+            }
+            removed = compact->datas[node];
+            node_release(compact, node);
+            node = NIL;
+            found = true;
+            break;
+        }
+        if(!is_red(compact, right) && !is_red(compact, compact->nodes[right].left)) {
+            uint32_t old_node = node;
+            node = move_red_right(compact, node);
+            if(node != old_node)
+                result = 1;
+        }
+        path[depth] = node;
+        dirs[depth++] = true;
+        if(result == 0) {
+            /* the successor's item moves into the target and the successor's node goes instead */
+            uint32_t target = node;
+            node = compact->nodes[node].right;
+            while(compact->nodes[node].left != NIL) {
+                uint32_t left = compact->nodes[node].left;
+                if(!is_red(compact, left) && !is_red(compact, compact->nodes[left].left))
+                    node = move_red_left(compact, node);
+                path[depth] = node;
+                dirs[depth++] = false;
+                node = compact->nodes[node].left;
+            }
+            removed = compact->datas[target];
+            compact->datas[target] = compact->datas[node];
+            node_release(compact, node);
+            node = NIL;
+            found = true;
+            break;
+        }
+        node = compact->nodes[node].right;
+    }
+    compact->root = unwind(compact, path, dirs, depth, node);
+    if(compact->root != NIL)
+        set_red(compact, compact->root, false);
+    if(!found)
+        return false;
+    compact->item_num--;
+    if(removed_data)
+        *removed_data = removed;
+    else
+        compact->free_func(removed);
+    return true;
+}
+
+void *
+redblack_compact_get(RedBlackCompact *compact, void *data) {
+    uint32_t node = find(compact, data);
+    return node == NIL ? NULL : compact->datas[node];
+}
+
+void *
+redblack_compact_get_by_rank(RedBlackCompact *compact, size_t rank) {
+    if(rank < 1 || rank > compact->item_num)
+        return NULL;
+    uint32_t node = compact->root;
+    for(;;) {
+        size_t left_num = get_count(compact, compact->nodes[node].left);
+        if(rank == left_num + 1)
+            return compact->datas[node];
+        if(rank <= left_num)
+            node = compact->nodes[node].left;
+        else {
+            rank -= left_num + 1;
+            node = compact->nodes[node].right;
+        }
+    }
+}
+
+size_t
+redblack_compact_count_less(RedBlackCompact *compact, void *data, bool *found) {
+    size_t less_num = 0;
+    uint32_t node = compact->root;
+    *found = false;
+    while(node != NIL) {
+        int result = compact->cmp_func(data, compact->datas[node]);
+        if(result < 0)
+            node = compact->nodes[node].left;
+        else if(result > 0) {
+            less_num += get_count(compact, compact->nodes[node].left) + 1;
+            node = compact->nodes[node].right;
+        }
+        else {
+            *found = true;
+            return less_num + get_count(compact, compact->nodes[node].left);
+        }
+    }
+    return less_num;
+}
+
+size_t
+redblack_compact_count_by_score(RedBlackCompact *compact, void *data,
+        CmpScoreFunc cmp_score_func, bool inclusive) {
+    size_t num = 0;
+    uint32_t node = compact->root;
+    while(node != NIL) {
+        int result = cmp_score_func(compact->datas[node], data);
+        if(result < 0 || (inclusive && result == 0)) {
+            num += get_count(compact, compact->nodes[node].left) + 1;
+            node = compact->nodes[node].right;
+        }
+        else
+            node = compact->nodes[node].left;
+    }
+    return num;
+}
+
+void
+redblack_compact_get_range_by_rank(RedBlackCompact *compact,
+        size_t start_rank, size_t end_rank, TraverseRangeFunc func) {
+    if(end_rank > compact->item_num)
+        end_rank = compact->item_num;
+    if(start_rank < 1)
+        start_rank = 1;
+    if(start_rank <= end_rank)
+        get_range_by_rank(compact, compact->root, start_rank, end_rank, 0, func);
+}
+
+size_t
+redblack_compact_get_extremes(RedBlackCompact *compact, size_t n, void **items, bool from_max) {
+    uint32_t path[REDBLACK_MAX_HEIGHT];
+    int depth = 0;
+    size_t item_num = 0;
+    uint32_t node = compact->root;
+    while(item_num < n && (node != NIL || depth > 0)) {
+        while(node != NIL) {
+            path[depth++] = node;
+            node = from_max ? compact->nodes[node].right : compact->nodes[node].left;
+        }
+        node = path[--depth];
+        items[item_num++] = compact->datas[node];
+        node = from_max ? compact->nodes[node].left : compact->nodes[node].right;
+    }
+    return item_num;
+}
+
+/* grows by a quarter, as large reallocs are remapped rather than copied and slack is what this backend is
+ * meant to save */
+static void
+reserve(RedBlackCompact *compact) {
+    if(compact->free_list != NIL || compact->used_num < compact->capacity)
+        return;
+    assert(compact->capacity < MAX_CAPACITY);
+    uint32_t capacity = compact->capacity < MIN_CAPACITY ? MIN_CAPACITY : compact->capacity + compact->capacity / 4;
+    if(capacity > MAX_CAPACITY)
+        capacity = MAX_CAPACITY;
+    compact->nodes = realloc(compact->nodes, capacity * sizeof(*compact->nodes));
+    compact->datas = realloc(compact->datas, capacity * sizeof(*compact->datas));
+    compact->capacity = capacity;
+}
+
+static uint32_t
+node_new(RedBlackCompact *compact, void *data) {
+    uint32_t node = compact->free_list;
+    if(node != NIL)
+        compact->free_list = compact->nodes[node].left;
+    else
+        node = compact->used_num++;
+    compact->nodes[node].left = NIL;
+    compact->nodes[node].right = NIL;
+    compact->nodes[node].count = RED_BIT | 1;
+    compact->datas[node] = data;
+    return node;
+}
+
+static void
+node_release(RedBlackCompact *compact, uint32_t node) {
+    compact->nodes[node].left = compact->free_list;
+    compact->free_list = node;
+}
+
+static void
+free_datas(RedBlackCompact *compact, uint32_t node) {
+    if(node == NIL)
+        return;
+    free_datas(compact, compact->nodes[node].left);
+    free_datas(compact, compact->nodes[node].right);
+    compact->free_func(compact->datas[node]);
+}
+
+static bool
+is_red(RedBlackCompact *compact, uint32_t node) {
+    return node != NIL && (compact->nodes[node].count & RED_BIT);
+}
+
+static void
+set_red(RedBlackCompact *compact, uint32_t node, bool red) {
+    if(red)
+        compact->nodes[node].count |= RED_BIT;
+    else
+        compact->nodes[node].count &= ~RED_BIT;
+}
+
+static size_t
+get_count(RedBlackCompact *compact, uint32_t node) {
+    return node == NIL ? 0 : compact->nodes[node].count & ~RED_BIT;
+}
+
+static void
+update_count(RedBlackCompact *compact, uint32_t node) {
+    CompactNode *n = &compact->nodes[node];
+    n->count = (n->count & RED_BIT) | (uint32_t)(get_count(compact, n->left) + get_count(compact, n->right) + 1);
+}
+
+static uint32_t
+rotate_left(RedBlackCompact *compact, uint32_t node) {
+    uint32_t right = compact->nodes[node].right;
+    compact->nodes[node].right = compact->nodes[right].left;
+    compact->nodes[right].left = node;
+    set_red(compact, right, is_red(compact, node));
+    set_red(compact, node, true);
+    compact->nodes[right].count = (compact->nodes[right].count & RED_BIT) | (compact->nodes[node].count & ~RED_BIT);
+    update_count(compact, node);
+    return right;
+}
+
+static uint32_t
+rotate_right(RedBlackCompact *compact, uint32_t node) {
+    uint32_t left = compact->nodes[node].left;
+    compact->nodes[node].left = compact->nodes[left].right;
+    compact->nodes[left].right = node;
+    set_red(compact, left, is_red(compact, node));
+    set_red(compact, node, true);
+    compact->nodes[left].count = (compact->nodes[left].count & RED_BIT) | (compact->nodes[node].count & ~RED_BIT);
+    update_count(compact, node);
+    return left;
+}
+
+static void
+flip_colors(RedBlackCompact *compact, uint32_t node) {
+    compact->nodes[node].count ^= RED_BIT;
+    compact->nodes[compact->nodes[node].left].count ^= RED_BIT;
+    compact->nodes[compact->nodes[node].right].count ^= RED_BIT;
+}
+
+static uint32_t
+balance(RedBlackCompact *compact, uint32_t node) {
+    bool changed;
+    return rebalance(compact, node, &changed);
+}
+
+static uint32_t
+rebalance(RedBlackCompact *compact, uint32_t node, bool *changed) {
+    *changed = false;
+    if(is_red(compact, compact->nodes[node].right) && !is_red(compact, compact->nodes[node].left)) {
+        node = rotate_left(compact, node);
+        *changed = true;
+    }
+    if(is_red(compact, compact->nodes[node].left)
+            && is_red(compact, compact->nodes[compact->nodes[node].left].left)) {
+        node = rotate_right(compact, node);
+        *changed = true;
+    }
+    if(is_red(compact, compact->nodes[node].left) && is_red(compact, compact->nodes[node].right)) {
+        flip_colors(compact, node);
+        *changed = true;
+    }
+    update_count(compact, node);
+    return node;
+}
+
+static uint32_t
+unwind(RedBlackCompact *compact, uint32_t *path, bool *dirs, int depth, uint32_t node) {
+    while(depth > 0) {
+        uint32_t parent = path[--depth];
+        if(dirs[depth])
+            compact->nodes[parent].right = node;
+        else
+            compact->nodes[parent].left = node;
+        node = balance(compact, parent);
+    }
+    return node;
+}
+
+static uint32_t
+move_red_left(RedBlackCompact *compact, uint32_t node) {
+    flip_colors(compact, node);
+    uint32_t right = compact->nodes[node].right;
+    if(is_red(compact, compact->nodes[right].left)) {
+        compact->nodes[node].right = rotate_right(compact, right);
+        node = rotate_left(compact, node);
+        flip_colors(compact, node);
+    }
+    return node;
+}
+
+static uint32_t
+move_red_right(RedBlackCompact *compact, uint32_t node) {
+    flip_colors(compact, node);
+    if(is_red(compact, compact->nodes[compact->nodes[node].left].left)) {
+        node = rotate_right(compact, node);
+        flip_colors(compact, node);
+    }
+    return node;
+}
+
+static uint32_t
+find(RedBlackCompact *compact, void *data) {
+    uint32_t node = compact->root;
+    while(node != NIL) {
+        int result = compact->cmp_func(data, compact->datas[node]);
+        if(result == 0)
+            return node;
+        node = result < 0 ? compact->nodes[node].left : compact->nodes[node].right;
+    }
+    return NIL;
+}
+
+static void
+get_range_by_rank(RedBlackCompact *compact, uint32_t node,
+        size_t start_rank, size_t end_rank, size_t left_rank, TraverseRangeFunc func) {
+    if(node == NIL)
+        return;
+    size_t node_rank = left_rank + get_count(compact, compact->nodes[node].left) + 1;
+    if(node_rank > start_rank)
+        get_range_by_rank(compact, compact->nodes[node].left, start_rank, end_rank, left_rank, func);
+    if(node_rank >= start_rank && node_rank <= end_rank)
+        func(compact->datas[node]);
+    if(node_rank < end_rank)
+        get_range_by_rank(compact, compact->nodes[node].right, start_rank, end_rank, node_rank, func);
+}
@@ -0,0 +1,21 @@
+#ifndef REDBLACK_COMPACT_H
+#define REDBLACK_COMPACT_H
+#include "redblack_bst.h"
+
+typedef struct redblack_compact RedBlackCompact;
+
+RedBlackCompact *redblack_compact_new(CmpFunc cmp_func, UpdateFunc update_func, FreeFunc free_func);
+void redblack_compact_free(RedBlackCompact *compact);
+size_t redblack_compact_size(RedBlackCompact *compact);
+bool redblack_compact_insert(RedBlackCompact *compact, void *data);
+bool redblack_compact_remove(RedBlackCompact *compact, void *data, void **removed_data);
+void *redblack_compact_get(RedBlackCompact *compact, void *data);
+void *redblack_compact_get_by_rank(RedBlackCompact *compact, size_t rank);
+size_t redblack_compact_count_less(RedBlackCompact *compact, void *data, bool *found);
+size_t redblack_compact_count_by_score(RedBlackCompact *compact, void *data,
+    CmpScoreFunc cmp_score_func, bool inclusive);
+void redblack_compact_get_range_by_rank(RedBlackCompact *compact,
+    size_t start_rank, size_t end_rank, TraverseRangeFunc func);
+size_t redblack_compact_get_extremes(RedBlackCompact *compact, size_t n, void **items, bool from_max);
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "redblack_concurrent.h"
+
+#define CACHE_LINE_SIZE 64
+#define IDLE_EPOCH 0
+
+typedef struct {
+    uint64_t epoch;
+    char pad[CACHE_LINE_SIZE - sizeof(uint64_t)];
+} ReaderSlot;
+
+typedef struct {
+    RedBlackBST *snapshot;
+    uint64_t epoch;
+} Retired;
+
+struct redblack_concurrent {
+    RedBlackBST *tree;
+    RedBlackBST *published;
+    uint64_t epoch;
+    pthread_mutex_t write_lock;
+    ReaderSlot *readers;
+    int max_reader_num;
+    int reader_num;
+    Retired *retired;
+    size_t retired_num;
+    size_t retired_capacity;
+};
+
+static void publish(RedBlackConcurrent *concurrent);
+static void reclaim(RedBlackConcurrent *concurrent);
+static uint64_t get_min_reader_epoch(RedBlackConcurrent *concurrent);
+
+RedBlackConcurrent *
+redblack_concurrent_new(RedBlackBST *tree, int max_reader_num) {
+    RedBlackConcurrent *concurrent = malloc(sizeof(*concurrent));
+    concurrent->tree = tree;
+    concurrent->published = redblack_snapshot(tree);
+    concurrent->epoch = IDLE_EPOCH + 1;
+    pthread_mutex_init(&concurrent->write_lock, NULL);
+    concurrent->readers = calloc(max_reader_num, sizeof(*concurrent->readers));
+    concurrent->max_reader_num = max_reader_num;
+    concurrent->reader_num = 0;
+    concurrent->retired = NULL;
+    concurrent->retired_num = 0;
+    concurrent->retired_capacity = 0;
+    return concurrent;
+}
+
+void
+redblack_concurrent_free(RedBlackConcurrent *concurrent) {
+    for(size_t i = 0;i < concurrent->retired_num;i++)
+        redblack_free(concurrent->retired[i].snapshot);
+    redblack_free(concurrent->published);
+    redblack_free(concurrent->tree);
+    pthread_mutex_destroy(&concurrent->write_lock);
+    free(concurrent->retired);
+    free(concurrent->readers);
+    free(concurrent);
+}
+
+RedBlackBST *
+redblack_concurrent_write_begin(RedBlackConcurrent *concurrent) {
+    pthread_mutex_lock(&concurrent->write_lock);
+    return concurrent->tree;
+}
+
+void
+redblack_concurrent_write_end(RedBlackConcurrent *concurrent) {
+    publish(concurrent);
+    reclaim(concurrent);
+    pthread_mutex_unlock(&concurrent->write_lock);
+}
+
+int
+redblack_concurrent_register_reader(RedBlackConcurrent *concurrent) {
+    int reader = __atomic_fetch_add(&concurrent->reader_num, 1, __ATOMIC_RELAXED);
+    assert(reader < concurrent->max_reader_num);
+    return reader;
+}
+
+RedBlackBST *
+redblack_concurrent_read_begin(RedBlackConcurrent *concurrent, int reader) {
+    uint64_t epoch = __atomic_load_n(&concurrent->epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&concurrent->readers[reader].epoch, epoch, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&concurrent->published, __ATOMIC_SEQ_CST);
+}
+
+void
+redblack_concurrent_read_end(RedBlackConcurrent *concurrent, int reader) {
+    __atomic_store_n(&concurrent->readers[reader].epoch, IDLE_EPOCH, __ATOMIC_RELEASE);
+}
+
+static void
+publish(RedBlackConcurrent *concurrent) {
+    RedBlackBST *old = __atomic_exchange_n(&concurrent->published,
+        redblack_snapshot(concurrent->tree), __ATOMIC_SEQ_CST);
+    if(concurrent->retired_num == concurrent->retired_capacity) {
+        concurrent->retired_capacity = concurrent->retired_capacity ? concurrent->retired_capacity * 2 : 16;
+        concurrent->retired = realloc(concurrent->retired,
+            concurrent->retired_capacity * sizeof(*concurrent->retired));
+    }
+    Retired *retired = &concurrent->retired[concurrent->retired_num++];
+    retired->snapshot = old;
+    retired->epoch = __atomic_fetch_add(&concurrent->epoch, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+reclaim(RedBlackConcurrent *concurrent) {
+    uint64_t min_epoch = get_min_reader_epoch(concurrent);
+    size_t kept_num = 0;
+    for(size_t i = 0;i < concurrent->retired_num;i++) {
+        Retired *retired = &concurrent->retired[i];
+        if(retired->epoch < min_epoch)
+            redblack_free(retired->snapshot);
+        else
+            concurrent->retired[kept_num++] = *retired;
+    }
+    concurrent->retired_num = kept_num;
+}
+
+static uint64_t
+get_min_reader_epoch(RedBlackConcurrent *concurrent) {
+    uint64_t min_epoch = UINT64_MAX;
+    int reader_num = __atomic_load_n(&concurrent->reader_num, __ATOMIC_ACQUIRE);
+    if(reader_num > concurrent->max_reader_num)
+        reader_num = concurrent->max_reader_num;
+    for(int i = 0;i < reader_num;i++) {
+        uint64_t epoch = __atomic_load_n(&concurrent->readers[i].epoch, __ATOMIC_SEQ_CST);
+        if(epoch != IDLE_EPOCH && epoch < min_epoch)
+            min_epoch = epoch;
+    }
+    return min_epoch;
+}
@@ -0,0 +1,16 @@
+#ifndef REDBLACK_CONCURRENT_H
+#define REDBLACK_CONCURRENT_H
+#include "redblack_bst.h"
+
+typedef struct redblack_concurrent RedBlackConcurrent;
+
+/* readers see published snapshots of tree, which must therefore have a copy_func */
+RedBlackConcurrent *redblack_concurrent_new(RedBlackBST *tree, int max_reader_num);
+void redblack_concurrent_free(RedBlackConcurrent *concurrent);
+RedBlackBST *redblack_concurrent_write_begin(RedBlackConcurrent *concurrent);
+void redblack_concurrent_write_end(RedBlackConcurrent *concurrent);
+int redblack_concurrent_register_reader(RedBlackConcurrent *concurrent);
+RedBlackBST *redblack_concurrent_read_begin(RedBlackConcurrent *concurrent, int reader);
+void redblack_concurrent_read_end(RedBlackConcurrent *concurrent, int reader);
+
+#endif
@@ -0,0 +1,204 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "redblack_io.h"
+
+#define SNAPSHOT_MAGIC 0x54534252u
+#define SNAPSHOT_VERSION 1u
+#define WRITE_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t item_num;
+    uint64_t payload_size;
+    uint64_t checksum;
+} SnapshotHeader;
+
+typedef struct {
+    int fd;
+    unsigned char *buffer;
+    size_t size;
+    size_t capacity;
+    uint64_t checksum;
+    uint64_t payload_size;
+} Writer;
+
+static uint64_t checksum_record(uint64_t checksum, const unsigned char *bytes, size_t size);
+static int verify_payload(const unsigned char *payload, const SnapshotHeader *header);
+static int write_all(int fd, const void *bytes, size_t size);
+static int writer_flush(Writer *writer);
+static int writer_reserve(Writer *writer, size_t size);
+
+int
+redblack_save(RedBlackBST *tree, int fd, SerializeFunc serialize_func) {
+    SnapshotHeader header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, 0, 0, 0};
+    if(write_all(fd, &header, sizeof(header)) < 0)
+        return -1;
+    Writer writer = {fd, malloc(WRITE_BUFFER_SIZE), 0, WRITE_BUFFER_SIZE, 0, 0};
+    /* the B-tree and compact backends keep no nodes to walk with a cursor, so their items are fetched by rank */
+    size_t item_num = redblack_get_node_num(tree);
+    bool by_rank = item_num > 0 && redblack_get_root(tree) == NULL;
+    RedBlackCursor cursor;
+    bool ok = false;
+    if(!by_rank) {
+        redblack_cursor_init(&cursor, tree);
+        ok = redblack_cursor_seek_first(&cursor);
+    }
+    for(size_t rank = 1;by_rank ? rank <= item_num : ok;rank++) {
+        void *data = by_rank ? redblack_get_by_rank(tree, rank) : redblack_cursor_get(&cursor);
+        size_t room = writer.capacity - writer.size;
+        size_t size = room > sizeof(uint32_t)
+            ? serialize_func(data, writer.buffer + writer.size + sizeof(uint32_t), room - sizeof(uint32_t))
+            : serialize_func(data, NULL, 0);
+        if(size > UINT32_MAX) {
+            free(writer.buffer);
+            errno = EOVERFLOW;
+            return -1;
+        }
+        if(sizeof(uint32_t) + size > room) {
+            if(writer_reserve(&writer, sizeof(uint32_t) + size) < 0) {
+                free(writer.buffer);
+                return -1;
+            }
+            serialize_func(data, writer.buffer + writer.size + sizeof(uint32_t), size);
+        }
+        uint32_t record_size = size;
+        memcpy(writer.buffer + writer.size, &record_size, sizeof(record_size));
+        writer.checksum = checksum_record(writer.checksum, writer.buffer + writer.size, sizeof(uint32_t) + size);
+        writer.size += sizeof(uint32_t) + size;
+        header.item_num++;
+        if(!by_rank)
+            ok = redblack_cursor_next(&cursor);
+    }
+    int result = writer_flush(&writer);
+    free(writer.buffer);
+    if(result < 0)
+        return -1;
+    header.payload_size = writer.payload_size;
+    header.checksum = writer.checksum;
+    off_t end = lseek(fd, 0, SEEK_CUR);
+    if(end < 0 || pwrite(fd, &header, sizeof(header), end - writer.payload_size - sizeof(header)) != sizeof(header))
+        return -1;
+    return 0;
+}
+
+int
+redblack_load(RedBlackBST *tree, int fd, DeserializeFunc deserialize_func) {
+    struct stat st;
+    if(fstat(fd, &st) < 0)
+        return -1;
+    if((size_t)st.st_size < sizeof(SnapshotHeader)) {
+        errno = EINVAL;
+        return -1;
+    }
+    unsigned char *bytes = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(bytes == MAP_FAILED)
+        return -1;
+    posix_madvise(bytes, st.st_size, POSIX_MADV_SEQUENTIAL);
+    SnapshotHeader header;
+    memcpy(&header, bytes, sizeof(header));
+    const unsigned char *payload = bytes + sizeof(header);
+    if(header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION
+            || header.payload_size != st.st_size - sizeof(header)
+            || verify_payload(payload, &header) < 0) {
+        munmap(bytes, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    void **items = malloc((header.item_num ? header.item_num : 1) * sizeof(*items));
+    size_t offset = 0;
+    for(uint64_t i = 0;i < header.item_num;i++) {
+        uint32_t record_size;
+        memcpy(&record_size, payload + offset, sizeof(record_size));
+        offset += sizeof(record_size);
+        items[i] = deserialize_func(payload + offset, record_size);
+        if(items[i] == NULL) {
+            FreeFunc free_func = redblack_get_free_func(tree);
+            while(i > 0)
+                free_func(items[--i]);
+            free(items);
+            munmap(bytes, st.st_size);
+            return -1;
+        }
+        offset += record_size;
+    }
+    munmap(bytes, st.st_size);
+    redblack_build_sorted(tree, items, header.item_num);
+    free(items);
+    return 0;
+}
+
+static uint64_t
+checksum_record(uint64_t checksum, const unsigned char *bytes, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+    for(;i + sizeof(uint64_t) <= size;i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    for(;i < size;i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    return (checksum ^ hash) * 0x9e3779b97f4a7c15ULL;
+}
+
+static int
+verify_payload(const unsigned char *payload, const SnapshotHeader *header) {
+    uint64_t checksum = 0;
+    size_t offset = 0;
+    for(uint64_t i = 0;i < header->item_num;i++) {
+        uint32_t record_size;
+        if(header->payload_size - offset < sizeof(record_size))
+            return -1;
+        memcpy(&record_size, payload + offset, sizeof(record_size));
+        if(header->payload_size - offset - sizeof(record_size) < record_size)
+            return -1;
+        checksum = checksum_record(checksum, payload + offset, sizeof(record_size) + record_size);
+        offset += sizeof(record_size) + record_size;
+    }
+    return offset == header->payload_size && checksum == header->checksum ? 0 : -1;
+}
+
+static int
+write_all(int fd, const void *bytes, size_t size) {
+    const unsigned char *p = bytes;
+    while(size > 0) {
+        ssize_t written = write(fd, p, size);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += written;
+        size -= written;
+    }
+    return 0;
+}
+
+static int
+writer_flush(Writer *writer) {
+    if(writer->size == 0)
+        return 0;
+    writer->payload_size += writer->size;
+    int result = write_all(writer->fd, writer->buffer, writer->size);
+    writer->size = 0;
+    return result;
+}
+
+static int
+writer_reserve(Writer *writer, size_t size) {
+    if(writer_flush(writer) < 0)
+        return -1;
+    if(size > writer->capacity) {
+        free(writer->buffer);
+        writer->buffer = malloc(size);
+        writer->capacity = size;
+    }
+    return 0;
+}
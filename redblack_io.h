@@ -0,0 +1,13 @@
+#ifndef REDBLACK_IO_H
+#define REDBLACK_IO_H
+#include "redblack_bst.h"
+
+typedef size_t (*SerializeFunc)(void *data, void *buffer, size_t buffer_size);
+typedef void *(*DeserializeFunc)(const void *buffer, size_t size);
+
+/* both return 0 on success and -1 with errno set on failure. deserialize_func returns NULL, setting errno, to
+ * fail a load, and the items it made so far are then passed to the tree's free_func */
+int redblack_save(RedBlackBST *tree, int fd, SerializeFunc serialize_func);
+int redblack_load(RedBlackBST *tree, int fd, DeserializeFunc deserialize_func);
+
+#endif
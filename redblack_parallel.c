@@ -0,0 +1,207 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include "redblack_parallel.h"
+
+/* a worker's deque only holds the forks of the task it is running, so it stays as shallow as the recursion */
+#define DEQUE_SIZE (REDBLACK_MAX_HEIGHT * 2)
+
+typedef struct {
+    TaskFunc func;
+    void *arg;
+    int done;
+} Task;
+
+typedef struct {
+    RedBlackThreadPool *thread_pool;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    Task *tasks[DEQUE_SIZE];
+    int top;
+    int bottom;
+    uint64_t seed;
+} Worker;
+
+struct redblack_thread_pool {
+    Worker *workers;
+    int thread_num;
+    pthread_mutex_t run_lock;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int active;
+    int stopping;
+};
+
+static __thread Worker *current_worker;
+
+static void *worker_main(void *arg);
+static void push(Worker *worker, Task *task);
+static bool pop(Worker *worker, Task *task);
+static bool steal(Worker *worker);
+static void wait_task(Worker *worker, Task *task);
+
+RedBlackThreadPool *
+redblack_thread_pool_new(int thread_num) {
+    assert(thread_num >= 1);
+    RedBlackThreadPool *thread_pool = malloc(sizeof(*thread_pool));
+    thread_pool->workers = calloc(thread_num, sizeof(*thread_pool->workers));
+    thread_pool->thread_num = thread_num;
+    pthread_mutex_init(&thread_pool->run_lock, NULL);
+    pthread_mutex_init(&thread_pool->lock, NULL);
+    pthread_cond_init(&thread_pool->cond, NULL);
+    thread_pool->active = 0;
+    thread_pool->stopping = 0;
+    for(int i = 0;i < thread_num;i++) {
+        Worker *worker = &thread_pool->workers[i];
+        worker->thread_pool = thread_pool;
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+    }
+    for(int i = 1;i < thread_num;i++)
+        pthread_create(&thread_pool->workers[i].thread, NULL, worker_main, &thread_pool->workers[i]);
+    return thread_pool;
+}
+
+void
+redblack_thread_pool_free(RedBlackThreadPool *thread_pool) {
+    pthread_mutex_lock(&thread_pool->lock);
+    __atomic_store_n(&thread_pool->stopping, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&thread_pool->cond);
+    pthread_mutex_unlock(&thread_pool->lock);
+    for(int i = 1;i < thread_pool->thread_num;i++)
+        pthread_join(thread_pool->workers[i].thread, NULL);
+    for(int i = 0;i < thread_pool->thread_num;i++)
+        pthread_mutex_destroy(&thread_pool->workers[i].lock);
+    pthread_cond_destroy(&thread_pool->cond);
+    pthread_mutex_destroy(&thread_pool->lock);
+    pthread_mutex_destroy(&thread_pool->run_lock);
+    free(thread_pool->workers);
+    free(thread_pool);
+}
+
+int
+redblack_thread_pool_get_thread_num(RedBlackThreadPool *thread_pool) {
+    return thread_pool->thread_num;
+}
+
+void
+redblack_thread_pool_run(RedBlackThreadPool *thread_pool, TaskFunc func, void *arg) {
+    if(current_worker && current_worker->thread_pool == thread_pool) {
+        func(arg);
+        return;
+    }
+    Worker *outer_worker = current_worker;
+    pthread_mutex_lock(&thread_pool->run_lock);
+    pthread_mutex_lock(&thread_pool->lock);
+    __atomic_store_n(&thread_pool->active, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&thread_pool->cond);
+    pthread_mutex_unlock(&thread_pool->lock);
+    current_worker = &thread_pool->workers[0];
+    func(arg);
+    current_worker = outer_worker;
+    __atomic_store_n(&thread_pool->active, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&thread_pool->run_lock);
+}
+
+void
+redblack_thread_pool_fork_join(RedBlackThreadPool *thread_pool,
+        TaskFunc func1, void *arg1, TaskFunc func2, void *arg2) {
+    Worker *worker = current_worker;
+    if(worker == NULL || worker->thread_pool != thread_pool || thread_pool->thread_num == 1) {
+        func1(arg1);
+        func2(arg2);
+        return;
+    }
+    Task task = {func2, arg2, 0};
+    push(worker, &task);
+    func1(arg1);
+    if(pop(worker, &task))
+        func2(arg2);
+    else
+        wait_task(worker, &task);
+}
+
+static void *
+worker_main(void *arg) {
+    Worker *worker = arg;
+    RedBlackThreadPool *thread_pool = worker->thread_pool;
+    current_worker = worker;
+    pthread_mutex_lock(&thread_pool->lock);
+    for(;;) {
+        while(!__atomic_load_n(&thread_pool->active, __ATOMIC_ACQUIRE)
+                && !__atomic_load_n(&thread_pool->stopping, __ATOMIC_RELAXED))
+            pthread_cond_wait(&thread_pool->cond, &thread_pool->lock);
+        if(__atomic_load_n(&thread_pool->stopping, __ATOMIC_RELAXED))
+            break;
+        pthread_mutex_unlock(&thread_pool->lock);
+        while(__atomic_load_n(&thread_pool->active, __ATOMIC_ACQUIRE)) {
+            if(!steal(worker))
+                sched_yield();
+        }
+        pthread_mutex_lock(&thread_pool->lock);
+    }
+    pthread_mutex_unlock(&thread_pool->lock);
+    return NULL;
+}
+
+static void
+push(Worker *worker, Task *task) {
+    pthread_mutex_lock(&worker->lock);
+    assert(worker->bottom < DEQUE_SIZE);
+    worker->tasks[worker->bottom++] = task;
+    pthread_mutex_unlock(&worker->lock);
+}
+
+/* takes task back from the owner's end unless a thief got it first */
+static bool
+pop(Worker *worker, Task *task) {
+    bool popped = false;
+    pthread_mutex_lock(&worker->lock);
+    if(worker->bottom > worker->top && worker->tasks[worker->bottom - 1] == task) {
+        worker->bottom--;
+        popped = true;
+    }
+    if(worker->bottom == worker->top) {
+        worker->top = 0;
+        worker->bottom = 0;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return popped;
+}
+
+/* runs the oldest task of a random victim, the one most likely to carry a large subproblem */
+static bool
+steal(Worker *worker) {
+    RedBlackThreadPool *thread_pool = worker->thread_pool;
+    worker->seed ^= worker->seed << 13;
+    worker->seed ^= worker->seed >> 7;
+    worker->seed ^= worker->seed << 17;
+    int start = worker->seed % thread_pool->thread_num;
+    for(int i = 0;i < thread_pool->thread_num;i++) {
+        Worker *victim = &thread_pool->workers[(start + i) % thread_pool->thread_num];
+        if(victim == worker)
+            continue;
+        Task *task = NULL;
+        pthread_mutex_lock(&victim->lock);
+        if(victim->top < victim->bottom)
+            task = victim->tasks[victim->top++];
+        pthread_mutex_unlock(&victim->lock);
+        if(task) {
+            task->func(task->arg);
+            __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* a stolen task is waited for by running other workers' tasks meanwhile */
+static void
+wait_task(Worker *worker, Task *task) {
+    while(!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+        if(!steal(worker))
+            sched_yield();
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef REDBLACK_PARALLEL_H
+#define REDBLACK_PARALLEL_H
+#include "redblack_bst.h"
+
+typedef struct redblack_thread_pool RedBlackThreadPool;
+
+typedef void (*TaskFunc)(void *arg);
+typedef void (*MapFunc)(void *acc, void *data);
+typedef void (*ReduceFunc)(void *acc, void *other_acc);
+
+/* a work-stealing pool of thread_num - 1 threads, the thread calling run being the last worker; run calls
+ * from different threads are serialized */
+RedBlackThreadPool *redblack_thread_pool_new(int thread_num);
+void redblack_thread_pool_free(RedBlackThreadPool *thread_pool);
+int redblack_thread_pool_get_thread_num(RedBlackThreadPool *thread_pool);
+void redblack_thread_pool_run(RedBlackThreadPool *thread_pool, TaskFunc func, void *arg);
+/* runs both functions and returns when both are done, the second one possibly on another worker;
+ * outside of run they are called one after the other */
+void redblack_thread_pool_fork_join(RedBlackThreadPool *thread_pool,
+    TaskFunc func1, void *arg1, TaskFunc func2, void *arg2);
+
+/* parallel bulk operations; a NULL thread_pool runs them on the calling thread. cmp_func, get_key_func and
+ * update_func may be called from several threads at once, on different items */
+void redblack_build_sorted_parallel(RedBlackBST *tree, void **items, size_t n, RedBlackThreadPool *thread_pool);
+/* unions every tree of others into tree as redblack_union does, an item present in several trees keeping
+ * the copy of the earliest one. a union only runs in parallel while neither side has live snapshots */
+void redblack_union_parallel(RedBlackBST *tree, RedBlackBST **others, size_t other_num,
+    RedBlackThreadPool *thread_pool);
+/* folds the items ranked start_rank to end_rank into acc, which holds acc_size bytes and starts as the
+ * identity of reduce_func; map_func folds one item into an accumulator and reduce_func appends other_acc
+ * to acc, so the result is the same as a left to right fold as long as reduce_func is associative */
+void redblack_map_range(RedBlackBST *tree, size_t start_rank, size_t end_rank,
+    MapFunc map_func, ReduceFunc reduce_func, void *acc, size_t acc_size, RedBlackThreadPool *thread_pool);
+
+#endif
@@ -0,0 +1,238 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "redblack_shard.h"
+
+#define CACHE_LINE_SIZE 64
+
+typedef union {
+    pthread_rwlock_t lock;
+    char pad[CACHE_LINE_SIZE];
+} ShardLock;
+
+struct redblack_shard {
+    RedBlackBST **trees;
+    ShardLock *locks;
+    int shard_num;
+    CmpFunc cmp_func;
+    GetIdFunc get_id_func;
+};
+
+static int shard_of(RedBlackShard *shard, uint64_t id);
+static size_t merge_ranks(RedBlackShard *shard, size_t *next_ranks, size_t *end_ranks, bool descending,
+    size_t n, void **items, TraverseRangeFunc func);
+
+RedBlackShard *
+redblack_shard_new(RedBlackBST **trees, int shard_num, CmpFunc cmp_func, GetIdFunc get_id_func) {
+    assert(shard_num >= 1);
+    RedBlackShard *shard = malloc(sizeof(*shard));
+    shard->trees = malloc(shard_num * sizeof(*shard->trees));
+    shard->locks = malloc(shard_num * sizeof(*shard->locks));
+    for(int i = 0;i < shard_num;i++) {
+        shard->trees[i] = trees[i];
+        pthread_rwlock_init(&shard->locks[i].lock, NULL);
+    }
+    shard->shard_num = shard_num;
+    shard->cmp_func = cmp_func;
+    shard->get_id_func = get_id_func;
+    return shard;
+}
+
+void
+redblack_shard_free(RedBlackShard *shard) {
+    for(int i = 0;i < shard->shard_num;i++) {
+        redblack_free(shard->trees[i]);
+        pthread_rwlock_destroy(&shard->locks[i].lock);
+    }
+    free(shard->locks);
+    free(shard->trees);
+    free(shard);
+}
+
+int
+redblack_shard_get_shard_num(RedBlackShard *shard) {
+    return shard->shard_num;
+}
+
+RedBlackBST *
+redblack_shard_write_begin(RedBlackShard *shard, uint64_t id) {
+    int i = shard_of(shard, id);
+    pthread_rwlock_wrlock(&shard->locks[i].lock);
+    return shard->trees[i];
+}
+
+void
+redblack_shard_write_end(RedBlackShard *shard, uint64_t id) {
+    pthread_rwlock_unlock(&shard->locks[shard_of(shard, id)].lock);
+}
+
+/* shards are always locked in index order, so readers never deadlock with one another */
+void
+redblack_shard_read_begin(RedBlackShard *shard) {
+    for(int i = 0;i < shard->shard_num;i++)
+        pthread_rwlock_rdlock(&shard->locks[i].lock);
+}
+
+void
+redblack_shard_read_end(RedBlackShard *shard) {
+    for(int i = shard->shard_num - 1;i >= 0;i--)
+        pthread_rwlock_unlock(&shard->locks[i].lock);
+}
+
+size_t
+redblack_shard_get_node_num(RedBlackShard *shard) {
+    size_t node_num = 0;
+    for(int i = 0;i < shard->shard_num;i++)
+        node_num += redblack_get_node_num(shard->trees[i]);
+    return node_num;
+}
+
+/* keeps a window of candidate local ranks per shard and probes the widest one: counting the items less than
+ * the probe in every shard gives its global rank, which narrows all the windows at once. a shard whose
+ * window is empty needs no count, as its items all order before or after every candidate. ids hash items
+ * evenly over the shards, so the probe is interpolated from the rank left to find, falling back to the
+ * middle of the window whenever the last two probes failed to halve the candidates */
+void *
+redblack_shard_get_by_rank(RedBlackShard *shard, size_t rank) {
+    if(rank < 1 || rank > redblack_shard_get_node_num(shard))
+        return NULL;
+    size_t low_ranks[shard->shard_num];
+    size_t high_ranks[shard->shard_num];
+    size_t less_nums[shard->shard_num];
+    for(int i = 0;i < shard->shard_num;i++) {
+        low_ranks[i] = 1;
+        high_ranks[i] = redblack_get_node_num(shard->trees[i]);
+    }
+    size_t last_candidate_nums[2] = {SIZE_MAX, SIZE_MAX};
+    for(;;) {
+        int widest = -1;
+        size_t widest_num = 0;
+        size_t candidate_num = 0;
+        size_t left_rank = rank;
+        for(int i = 0;i < shard->shard_num;i++) {
+            left_rank -= low_ranks[i] - 1;
+            if(high_ranks[i] < low_ranks[i])
+                continue;
+            candidate_num += high_ranks[i] - low_ranks[i] + 1;
+            if(high_ranks[i] - low_ranks[i] + 1 > widest_num) {
+                widest = i;
+                widest_num = high_ranks[i] - low_ranks[i] + 1;
+            }
+        }
+        assert(widest >= 0);
+        size_t probe_rank = low_ranks[widest] + (widest_num - 1) / 2;
+        if(candidate_num <= last_candidate_nums[1] / 2)
+            probe_rank = low_ranks[widest] + (size_t)((double)(left_rank - 1) * widest_num / candidate_num);
+        last_candidate_nums[1] = last_candidate_nums[0];
+        last_candidate_nums[0] = candidate_num;
+        void *data = redblack_get_by_rank(shard->trees[widest], probe_rank);
+        size_t global_rank = probe_rank;
+        for(int i = 0;i < shard->shard_num;i++) {
+            if(i == widest)
+                continue;
+            if(high_ranks[i] < low_ranks[i])
+                less_nums[i] = low_ranks[i] - 1;
+            else
+                less_nums[i] = redblack_count_less(shard->trees[i], data);
+            global_rank += less_nums[i];
+        }
+        if(global_rank == rank)
+            return data;
+        for(int i = 0;i < shard->shard_num;i++) {
+            if(global_rank < rank) {
+                size_t low_rank = i == widest ? probe_rank + 1 : less_nums[i] + 1;
+                if(low_rank > low_ranks[i])
+                    low_ranks[i] = low_rank;
+            }
+            else {
+                size_t high_rank = i == widest ? probe_rank - 1 : less_nums[i];
+                if(high_rank < high_ranks[i])
+                    high_ranks[i] = high_rank;
+            }
+        }
+    }
+}
+
+size_t
+redblack_shard_rank_of(RedBlackShard *shard, void *data) {
+    int home = shard_of(shard, shard->get_id_func(data));
+    size_t rank = redblack_rank_of(shard->trees[home], data);
+    if(rank == 0)
+        return 0;
+    for(int i = 0;i < shard->shard_num;i++) {
+        if(i != home)
+            rank += redblack_count_less(shard->trees[i], data);
+    }
+    return rank;
+}
+
+size_t
+redblack_shard_top_n(RedBlackShard *shard, size_t n, void **items) {
+    size_t next_ranks[shard->shard_num];
+    size_t end_ranks[shard->shard_num];
+    for(int i = 0;i < shard->shard_num;i++) {
+        next_ranks[i] = redblack_get_node_num(shard->trees[i]);
+        end_ranks[i] = 1;
+    }
+    return merge_ranks(shard, next_ranks, end_ranks, true, n, items, NULL);
+}
+
+void
+redblack_shard_get_range_by_score(RedBlackShard *shard,
+        void *min_data, void *max_data, TraverseRangeFunc func, CmpScoreFunc cmp_score_func) {
+    size_t next_ranks[shard->shard_num];
+    size_t end_ranks[shard->shard_num];
+    for(int i = 0;i < shard->shard_num;i++) {
+        RedBlackBST *tree = shard->trees[i];
+        next_ranks[i] = redblack_count_less_by_score(tree, min_data, cmp_score_func) + 1;
+        end_ranks[i] = next_ranks[i] + redblack_count_in_score_range(tree, min_data, max_data, cmp_score_func) - 1;
+    }
+    merge_ranks(shard, next_ranks, end_ranks, false, SIZE_MAX, NULL, func);
+}
+
+static int
+shard_of(RedBlackShard *shard, uint64_t id) {
+    return ((id * 0x9e3779b97f4a7c15ULL) >> 32) % shard->shard_num;
+}
+
+/* merges the local rank ranges next_ranks[i] to end_ranks[i], walking down when descending, into items or
+ * func; a shard whose range is empty has its next rank already past its end */
+static size_t
+merge_ranks(RedBlackShard *shard, size_t *next_ranks, size_t *end_ranks, bool descending,
+        size_t n, void **items, TraverseRangeFunc func) {
+    void *heads[shard->shard_num];
+    for(int i = 0;i < shard->shard_num;i++) {
+        bool empty = descending ? next_ranks[i] < end_ranks[i] : next_ranks[i] > end_ranks[i];
+        heads[i] = empty ? NULL : redblack_get_by_rank(shard->trees[i], next_ranks[i]);
+    }
+    size_t item_num = 0;
+    while(item_num < n) {
+        int best = -1;
+        for(int i = 0;i < shard->shard_num;i++) {
+            if(heads[i] == NULL)
+                continue;
+            if(best < 0) {
+                best = i;
+                continue;
+            }
+            int result = shard->cmp_func(heads[i], heads[best]);
+            if(descending ? result > 0 : result < 0)
+                best = i;
+        }
+        if(best < 0)
+            break;
+        if(items)
+            items[item_num] = heads[best];
+        else
+            func(heads[best]);
+        item_num++;
+        if(next_ranks[best] == end_ranks[best])
+            heads[best] = NULL;
+        else {
+            next_ranks[best] += descending ? -1 : 1;
+            heads[best] = redblack_get_by_rank(shard->trees[best], next_ranks[best]);
+        }
+    }
+    return item_num;
+}
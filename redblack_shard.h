@@ -0,0 +1,26 @@
+#ifndef REDBLACK_SHARD_H
+#define REDBLACK_SHARD_H
+#include "redblack_bst.h"
+
+typedef struct redblack_shard RedBlackShard;
+
+/* spreads items over shard_num trees by id, each behind its own lock, so writers to different shards run in
+ * parallel. the trees must order items with cmp_func, the container owning them from then on */
+RedBlackShard *redblack_shard_new(RedBlackBST **trees, int shard_num, CmpFunc cmp_func, GetIdFunc get_id_func);
+void redblack_shard_free(RedBlackShard *shard);
+int redblack_shard_get_shard_num(RedBlackShard *shard);
+/* write_begin locks and returns the tree holding id, whose items must all be modified through it */
+RedBlackBST *redblack_shard_write_begin(RedBlackShard *shard, uint64_t id);
+void redblack_shard_write_end(RedBlackShard *shard, uint64_t id);
+/* the global queries below must be called between read_begin and read_end, which lock every shard for
+ * reading; the items they return stay valid until read_end */
+void redblack_shard_read_begin(RedBlackShard *shard);
+void redblack_shard_read_end(RedBlackShard *shard);
+size_t redblack_shard_get_node_num(RedBlackShard *shard);
+void *redblack_shard_get_by_rank(RedBlackShard *shard, size_t rank);
+size_t redblack_shard_rank_of(RedBlackShard *shard, void *data);
+size_t redblack_shard_top_n(RedBlackShard *shard, size_t n, void **items);
+void redblack_shard_get_range_by_score(RedBlackShard *shard,
+    void *min_data, void *max_data, TraverseRangeFunc func, CmpScoreFunc cmp_score_func);
+
+#endif
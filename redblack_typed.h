@@ -0,0 +1,467 @@
+#ifndef REDBLACK_TYPED_H
+#define REDBLACK_TYPED_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef REDBLACK_MAX_HEIGHT
+#define REDBLACK_MAX_HEIGHT 128
+#endif
+
+/* REDBLACK_DEFINE(name, key_type, cmp_expr) emits name##_tree with keys stored in the nodes;
+ * cmp_expr compares the key_type values a and b and is inlined into every descent */
+#define REDBLACK_DEFINE(name, key_type, cmp_expr) \
+\
+typedef struct name##_node { \
+    key_type key; \
+    struct name##_node *left, *right; \
+    size_t sub_node_num; \
+    bool red; \
+} name##_node; \
+\
+typedef struct { \
+    name##_node *root; \
+} name##_tree; \
+\
+typedef void (*name##_traverse_func)(key_type *key); \
+\
+static inline int \
+name##_cmp(key_type a, key_type b) { \
+    return (cmp_expr); \
+} \
+\
+static inline bool \
+name##_is_red(name##_node *node) { \
+    return node && node->red; \
+} \
+\
+static inline size_t \
+name##_sub_node_num(name##_node *node) { \
+    return node ? node->sub_node_num : 0; \
+} \
+\
+static inline name##_node * \
+name##_rotate_left(name##_node *node) { \
+    name##_node *sub_tree_root = node->right; \
+    node->right = sub_tree_root->left; \
+    sub_tree_root->left = node; \
+    sub_tree_root->red = node->red; \
+    node->red = true; \
+    sub_tree_root->sub_node_num = node->sub_node_num; \
+    node->sub_node_num = name##_sub_node_num(node->left) + name##_sub_node_num(node->right) + 1; \
+    return sub_tree_root; \
+} \
+\
+static inline name##_node * \
+name##_rotate_right(name##_node *node) { \
+    name##_node *sub_tree_root = node->left; \
+    node->left = sub_tree_root->right; \
+    sub_tree_root->right = node; \
+    sub_tree_root->red = node->red; \
+    node->red = true; \
+    sub_tree_root->sub_node_num = node->sub_node_num; \
+    node->sub_node_num = name##_sub_node_num(node->left) + name##_sub_node_num(node->right) + 1; \
+    return sub_tree_root; \
+} \
+\
+static inline void \
+name##_flip_colors(name##_node *node) { \
+    node->red = !node->red; \
+    node->left->red = !node->left->red; \
+    node->right->red = !node->right->red; \
+} \
+\
+static inline name##_node * \
+name##_rebalance(name##_node *node, bool *changed) { \
+    *changed = false; \
+    if(name##_is_red(node->right) && !name##_is_red(node->left)) { \
+        node = name##_rotate_left(node); \
+        *changed = true; \
+    } \
+    if(name##_is_red(node->left) && name##_is_red(node->left->left)) { \
+        node = name##_rotate_right(node); \
+        *changed = true; \
+    } \
+    if(name##_is_red(node->left) && name##_is_red(node->right)) { \
+        name##_flip_colors(node); \
+        *changed = true; \
+    } \
+    node->sub_node_num = name##_sub_node_num(node->left) + name##_sub_node_num(node->right) + 1; \
+    return node; \
+} \
+\
+static inline name##_node * \
+name##_balance(name##_node *node) { \
+    bool changed; \
+    return name##_rebalance(node, &changed); \
+} \
+\
+/* hangs node back under the saved path, rebalancing every level on the way up */ \
+static inline name##_node * \
+name##_unwind(name##_node **path, bool *dirs, int depth, name##_node *node) { \
+    while(depth > 0) { \
+        name##_node *parent = path[--depth]; \
+        if(dirs[depth]) \
+            parent->right = node; \
+        else \
+            parent->left = node; \
+        node = name##_balance(parent); \
+    } \
+    return node; \
+} \
+\
+static inline name##_node * \
+name##_move_red_from_right_to_left(name##_node *node) { \
+    name##_flip_colors(node); \
+    if(name##_is_red(node->right->left)) { \
+        node->right = name##_rotate_right(node->right); \
+        node = name##_rotate_left(node); \
+        name##_flip_colors(node); \
+    } \
+    return node; \
+} \
+\
+static inline name##_node * \
+name##_move_red_from_left_to_right(name##_node *node) { \
+    name##_flip_colors(node); \
+    if(name##_is_red(node->left->left)) { \
+        node = name##_rotate_right(node); \
+        name##_flip_colors(node); \
+    } \
+    return node; \
+} \
+\
+static inline void \
+name##_init(name##_tree *tree) { \
+    tree->root = NULL; \
+} \
+\
+static inline void \
+name##_free_nodes(name##_node *node) { \
+    while(node) { \
+        name##_free_nodes(node->left); \
+        name##_node *right = node->right; \
+        free(node); \
+        node = right; \
+    } \
+} \
+\
+static inline void \
+name##_free(name##_tree *tree) { \
+    name##_free_nodes(tree->root); \
+    tree->root = NULL; \
+} \
+\
+static inline size_t \
+name##_size(name##_tree *tree) { \
+    return name##_sub_node_num(tree->root); \
+} \
+\
+static inline bool \
+name##_is_empty(name##_tree *tree) { \
+    return tree->root == NULL; \
+} \
+\
+static inline key_type * \
+name##_get(name##_tree *tree, key_type key) { \
+    name##_node *node = tree->root; \
+    while(node) { \
+        int result = name##_cmp(key, node->key); \
+        if(result == 0) \
+            return &node->key; \
+        node = result > 0 ? node->right : node->left; \
+    } \
+    return NULL; \
+} \
+\
+static inline bool \
+name##_insert(name##_tree *tree, key_type key) { \
+    name##_node *path[REDBLACK_MAX_HEIGHT]; \
+    bool dirs[REDBLACK_MAX_HEIGHT]; \
+    int depth = 0; \
+    name##_node *node = tree->root; \
+    while(node) { \
+        int result = name##_cmp(key, node->key); \
+        if(result == 0) { \
+            node->key = key; \
+            return false; \
+        } \
+        path[depth] = node; \
+        dirs[depth++] = result > 0; \
+        node = result > 0 ? node->right : node->left; \
+    } \
+    node = malloc(sizeof(*node)); \
+    node->key = key; \
+    node->left = NULL; \
+    node->right = NULL; \
+    node->sub_node_num = 1; \
+    node->red = true; \
+    /* once two consecutive levels need no rotation or flip, nothing above them can change */ \
+    int quiet_num = 0; \
+    while(depth > 0) { \
+        name##_node *parent = path[--depth]; \
+        if(quiet_num >= 2) { \
+            parent->sub_node_num++; \
+            continue; \
+        } \
+        if(dirs[depth]) \
+            parent->right = node; \
+        else \
+            parent->left = node; \
+        bool changed; \
+        node = name##_rebalance(parent, &changed); \
+        quiet_num = changed ? 0 : quiet_num + 1; \
+    } \
+    if(quiet_num < 2) \
+        tree->root = node; \
+    tree->root->red = false; \
+    return true; \
+} \
+\
+static inline bool \
+name##_delete(name##_tree *tree, key_type key) { \
+    name##_node *path[REDBLACK_MAX_HEIGHT]; \
+    bool dirs[REDBLACK_MAX_HEIGHT]; \
+    int depth = 0; \
+    if(tree->root == NULL) \
+        return false; \
+    if(!name##_is_red(tree->root->left) && !name##_is_red(tree->root->right)) \
+        tree->root->red = true; \
+    name##_node *node = tree->root; \
+    bool found = false; \
+    for(;;) { \
+        int result = name##_cmp(key, node->key); \
+        if(result < 0) { \
+            if(node->left == NULL) { \
+                node = name##_balance(node); \
+                break; \
+            } \
+            if(!name##_is_red(node->left) && !name##_is_red(node->left->left)) \
+                node = name##_move_red_from_right_to_left(node); \
+            path[depth] = node; \
+            dirs[depth++] = false; \
+            node = node->left; \
+            continue; \
+        } \
+        if(name##_is_red(node->left)) { \
+            node = name##_rotate_right(node); \
+            result = 1; \
+        } \
+        if(node->right == NULL) { \
+            if(result != 0) { \
+                node = name##_balance(node); \
+                break; \
+            } \
+            free(node); \
+            node = NULL; \
+            found = true; \
+            break; \
+        } \
+        if(!name##_is_red(node->right) && !name##_is_red(node->right->left)) { \
+            name##_node *old_node = node; \
+            node = name##_move_red_from_left_to_right(node); \
+            if(node != old_node) \
+                result = 1; \
+        } \
+        path[depth] = node; \
+        dirs[depth++] = true; \
+        if(result == 0) { \
+            /* the successor takes the place of the deleted node */ \
+            name##_node *target = node; \
+            int target_depth = depth - 1; \
+            node = node->right; \
+            while(node->left) { \
+                if(!name##_is_red(node->left) && !name##_is_red(node->left->left)) \
+                    node = name##_move_red_from_right_to_left(node); \
+                path[depth] = node; \
+                dirs[depth++] = false; \
+                node = node->left; \
+            } \
+            node->left = target->left; \
+            node->right = target->right; \
+            node->red = target->red; \
+            path[target_depth] = node; \
+            free(target); \
+            node = NULL; \
+            found = true; \
+            break; \
+        } \
+        node = node->right; \
+    } \
+    tree->root = name##_unwind(path, dirs, depth, node); \
+    if(tree->root) \
+        tree->root->red = false; \
+    return found; \
+} \
+\
+static inline void \
+name##_delete_min(name##_tree *tree) { \
+    name##_node *path[REDBLACK_MAX_HEIGHT]; \
+    bool dirs[REDBLACK_MAX_HEIGHT]; \
+    int depth = 0; \
+    if(tree->root == NULL) \
+        return; \
+    if(!name##_is_red(tree->root->left) && !name##_is_red(tree->root->right)) \
+        tree->root->red = true; \
+    name##_node *node = tree->root; \
+    while(node->left) { \
+        if(!name##_is_red(node->left) && !name##_is_red(node->left->left)) \
+            node = name##_move_red_from_right_to_left(node); \
+        path[depth] = node; \
+        dirs[depth++] = false; \
+        node = node->left; \
+    } \
+    free(node); \
+    tree->root = name##_unwind(path, dirs, depth, NULL); \
+    if(tree->root) \
+        tree->root->red = false; \
+} \
+\
+static inline void \
+name##_delete_max(name##_tree *tree) { \
+    name##_node *path[REDBLACK_MAX_HEIGHT]; \
+    bool dirs[REDBLACK_MAX_HEIGHT]; \
+    int depth = 0; \
+    if(tree->root == NULL) \
+        return; \
+    if(!name##_is_red(tree->root->left) && !name##_is_red(tree->root->right)) \
+        tree->root->red = true; \
+    name##_node *node = tree->root; \
+    for(;;) { \
+        if(name##_is_red(node->left)) \
+            node = name##_rotate_right(node); \
+        if(node->right == NULL) \
+            break; \
+        if(!name##_is_red(node->right) && !name##_is_red(node->right->left)) \
+            node = name##_move_red_from_left_to_right(node); \
+        path[depth] = node; \
+        dirs[depth++] = true; \
+        node = node->right; \
+    } \
+    free(node); \
+    tree->root = name##_unwind(path, dirs, depth, NULL); \
+    if(tree->root) \
+        tree->root->red = false; \
+} \
+\
+static inline key_type * \
+name##_get_min(name##_tree *tree) { \
+    name##_node *node = tree->root; \
+    if(node == NULL) \
+        return NULL; \
+    while(node->left) \
+        node = node->left; \
+    return &node->key; \
+} \
+\
+static inline key_type * \
+name##_get_max(name##_tree *tree) { \
+    name##_node *node = tree->root; \
+    if(node == NULL) \
+        return NULL; \
+    while(node->right) \
+        node = node->right; \
+    return &node->key; \
+} \
+\
+static inline key_type * \
+name##_get_by_rank(name##_tree *tree, size_t rank) { \
+    name##_node *node = tree->root; \
+    while(node) { \
+        size_t left_num = name##_sub_node_num(node->left); \
+        if(rank < left_num + 1) \
+            node = node->left; \
+        else if(rank > left_num + 1) { \
+            rank -= left_num + 1; \
+            node = node->right; \
+        } \
+        else \
+            return &node->key; \
+    } \
+    return NULL; \
+} \
+\
+static inline size_t \
+name##_count_less_found(name##_tree *tree, key_type key, bool *found) { \
+    name##_node *node = tree->root; \
+    size_t less_num = 0; \
+    while(node) { \
+        int result = name##_cmp(key, node->key); \
+        if(result > 0) { \
+            less_num += name##_sub_node_num(node->left) + 1; \
+            node = node->right; \
+        } \
+        else if(result < 0) \
+            node = node->left; \
+        else { \
+            *found = true; \
+            return less_num + name##_sub_node_num(node->left); \
+        } \
+    } \
+    *found = false; \
+    return less_num; \
+} \
+\
+static inline size_t \
+name##_count_less(name##_tree *tree, key_type key) { \
+    bool found; \
+    return name##_count_less_found(tree, key, &found); \
+} \
+\
+static inline size_t \
+name##_rank_of(name##_tree *tree, key_type key) { \
+    bool found; \
+    size_t less_num = name##_count_less_found(tree, key, &found); \
+    return found ? less_num + 1 : 0; \
+} \
+\
+static inline void \
+name##_traverse_range(name##_node *node, key_type *min, key_type *max, name##_traverse_func func) { \
+    while(node) { \
+        if(min && name##_cmp(node->key, *min) < 0) { \
+            node = node->right; \
+            continue; \
+        } \
+        if(max && name##_cmp(node->key, *max) > 0) { \
+            node = node->left; \
+            continue; \
+        } \
+        name##_traverse_range(node->left, min, NULL, func); \
+        func(&node->key); \
+        min = NULL; \
+        node = node->right; \
+    } \
+} \
+\
+static inline void \
+name##_get_range(name##_tree *tree, key_type min, key_type max, name##_traverse_func func) { \
+    name##_traverse_range(tree->root, &min, &max, func); \
+} \
+\
+static inline void \
+name##_traverse_rank(name##_node *node, size_t start_rank, size_t end_rank, name##_traverse_func func) { \
+    while(node) { \
+        size_t left_num = name##_sub_node_num(node->left); \
+        if(start_rank <= left_num) \
+            name##_traverse_rank(node->left, start_rank, end_rank, func); \
+        if(end_rank <= left_num) \
+            return; \
+        if(start_rank <= left_num + 1) \
+            func(&node->key); \
+        start_rank = start_rank > left_num + 1 ? start_rank - left_num - 1 : 1; \
+        end_rank -= left_num + 1; \
+        if(end_rank == 0) \
+            return; \
+        node = node->right; \
+    } \
+} \
+\
+static inline void \
+name##_get_range_by_rank(name##_tree *tree, size_t start_rank, size_t end_rank, name##_traverse_func func) { \
+    if(start_rank == 0) \
+        start_rank = 1; \
+    if(start_rank <= end_rank) \
+        name##_traverse_rank(tree->root, start_rank, end_rank, func); \
+}
+
+#endif
@@ -2,14 +2,25 @@
 #include <inttypes.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "redblack_bst.h"
+#include "redblack_parallel.h"
+#include "redblack_io.h"
+#include "redblack_buffer.h"
+#include "redblack_shard.h"
 #include "redblack_draw.h"
+#include "redblack_typed.h"
 
 typedef struct {
     uint64_t roleid;
     uint64_t score;
 } Score;
 
+REDBLACK_DEFINE(score_key, uint64_t, (a > b) - (a < b))
+
 static int
 cmp_func(void *data1, void *data2) {
     Score *score1 = (Score *)data1;
@@ -51,6 +62,18 @@ get_draw_str_func(RedBlackNode *node) {
     return (const char *)draw_buffer;
 }
 
+static void *
+copy_func(void *data) {
+    Score *score = malloc(sizeof(*score));
+    *score = *(Score *)data;
+    return score;
+}
+
+static uint64_t
+get_id_func(void *data) {
+    return ((Score *)data)->roleid;
+}
+
 static int
 cmp_score_func(void *data1, void *data2) {
     Score *score1 = (Score *)data1;
@@ -69,8 +92,88 @@ traverse_func(void *data) {
     printf("roleid:%"PRId64",score:%"PRId64"\n", score->roleid, score->score);
 }
 
+static void
+sum_score_func(void *acc, void *data) {
+    *(uint64_t *)acc += ((Score *)data)->score;
+}
+
+static void
+add_func(void *acc, void *other_acc) {
+    *(uint64_t *)acc += *(uint64_t *)other_acc;
+}
+
+static void
+traverse_key_func(uint64_t *key) {
+    printf("key:%"PRIu64"\n", *key);
+}
+
+static Score *
+make_score(uint64_t roleid, uint64_t score) {
+    Score *data = malloc(sizeof(*data));
+    data->roleid = roleid;
+    data->score = score;
+    return data;
+}
+
+static size_t
+serialize_func(void *data, void *buffer, size_t buffer_size) {
+    if(buffer_size >= sizeof(Score))
+        memcpy(buffer, data, sizeof(Score));
+    return sizeof(Score);
+}
+
+static void *
+deserialize_func(const void *buffer, size_t size) {
+    if(size != sizeof(Score)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    Score *score = malloc(sizeof(*score));
+    memcpy(score, buffer, sizeof(*score));
+    return score;
+}
+
+static void *
+reject_func(const void *buffer, size_t size) {
+    Score *score = deserialize_func(buffer, size);
+    if(score->roleid == 5) {
+        free(score);
+        errno = EINVAL;
+        return NULL;
+    }
+    return score;
+}
+
+static uint64_t
+get_key_func(void *data) {
+    return ((Score *)data)->score;
+}
+
+/* other must hold the same items as tree, in the same order */
+static void
+check_same_order(RedBlackBST *tree, RedBlackBST *other) {
+    assert(redblack_get_node_num(tree) == redblack_get_node_num(other));
+    for(size_t rank = 1;rank <= redblack_get_node_num(tree);rank++) {
+        Score *score = redblack_get_by_rank(tree, rank);
+        Score *other_score = redblack_get_by_rank(other, rank);
+        assert(score->roleid == other_score->roleid && score->score == other_score->score);
+        assert(redblack_rank_of(other, score) == rank);
+        assert(redblack_get(other, score) == other_score);
+    }
+}
+
+static void
+sum_aggregate_func(void *aggregate, void *data, const void *left, const void *right) {
+    uint64_t sum = ((Score *)data)->score;
+    if(left)
+        sum += *(const uint64_t *)left;
+    if(right)
+        sum += *(const uint64_t *)right;
+    *(uint64_t *)aggregate = sum;
+}
+
 int main() {
-    RedBlackBST *tree = redblack_new(cmp_func, update_func, free_func, get_draw_str_func);
+    RedBlackBST *tree = redblack_new_with_pool(cmp_func, update_func, free_func, get_draw_str_func, 64);
     for(int i = 0;i < 10;i++) {
         Score *score = malloc(sizeof(*score));
         score->roleid = i;
@@ -111,11 +214,311 @@ int main() {
     Score *rank_score = redblack_get_by_rank(tree, rank);
     printf("rank:%ld,roleid:%"PRId64",score:%"PRId64"\n", rank, rank_score->roleid, rank_score->score);
 
+    Score rank_key = {7, 17};
+    printf("rank of roleid:7 is %zu\n", redblack_rank_of(tree, &rank_key));
+    void *top_scores[3];
+    size_t top_num = redblack_top_n(tree, 3, top_scores);
+    for(size_t i = 0;i < top_num;i++)
+        printf("top %zu,roleid:%"PRId64",score:%"PRId64"\n", i + 1,
+            ((Score *)top_scores[i])->roleid, ((Score *)top_scores[i])->score);
+
     Score score1 = {0, 11};
     Score score2 = {0, 18};
+    printf("count in score range:%zu\n", redblack_count_in_score_range(tree, &score1, &score2, cmp_score_func));
+    Score *median_score = redblack_quantile(tree, 0.5);
+    printf("median,roleid:%"PRId64",score:%"PRId64"\n", median_score->roleid, median_score->score);
+    Score bucket_scores[2] = {{0, 12}, {0, 16}};
+    void *boundaries[2] = {&bucket_scores[0], &bucket_scores[1]};
+    size_t bucket_counts[3];
+    redblack_histogram(tree, boundaries, 2, cmp_score_func, bucket_counts);
+    printf("histogram:%zu,%zu,%zu\n", bucket_counts[0], bucket_counts[1], bucket_counts[2]);
     redblack_get_range_by_score(tree, &score1, &score2, traverse_func, cmp_score_func);
     printf("--------------\n");
     redblack_get_range_by_rank(tree, 2, 11, traverse_func);
+    printf("--------------\n");
+    RedBlackCursor cursor;
+    redblack_cursor_init(&cursor, tree);
+    for(bool ok = redblack_cursor_seek_by_score(&cursor, &score1, cmp_score_func);ok && redblack_cursor_get_rank(&cursor) < 6;
+            ok = redblack_cursor_next(&cursor)) {
+        Score *cursor_score = redblack_cursor_get(&cursor);
+        printf("cursor rank:%zu,roleid:%"PRId64",score:%"PRId64"\n", redblack_cursor_get_rank(&cursor),
+            cursor_score->roleid, cursor_score->score);
+    }
+    printf("--------------\n");
+    redblack_set_id_func(tree, get_id_func);
+    redblack_set_copy_func(tree, copy_func);
+    RedBlackBST *snapshot = redblack_snapshot(tree);
+    Score new_score = {5, 20};
+    redblack_update_key(tree, &new_score);
+    Score *id_score = redblack_get_by_id(tree, 5);
+    printf("update roleid:%"PRId64",score:%"PRId64"\n", id_score->roleid, id_score->score);
+    redblack_get_range_by_rank(tree, 1, 11, traverse_func);
+    printf("--------------\n");
+    redblack_get_range_by_rank(snapshot, 1, 11, traverse_func);
+    printf("--------------\n");
+    void *popped_scores[2];
+    size_t popped_num = redblack_pop_max_n(tree, 2, popped_scores);
+    for(size_t i = 0;i < popped_num;i++) {
+        printf("popped roleid:%"PRId64",score:%"PRId64"\n",
+            ((Score *)popped_scores[i])->roleid, ((Score *)popped_scores[i])->score);
+        free_func(popped_scores[i]);
+    }
+    redblack_get_range_by_rank(snapshot, 1, 11, traverse_func);
+    redblack_free(snapshot);
+    RedBlackThreadPool *thread_pool = redblack_thread_pool_new(2);
+    uint64_t score_sum = 0;
+    redblack_map_range(tree, 1, redblack_get_node_num(tree), sum_score_func, add_func, &score_sum, sizeof(score_sum), thread_pool);
+    printf("score sum:%"PRIu64"\n", score_sum);
+    redblack_thread_pool_free(thread_pool);
+    RedBlackPoolStats stats;
+    redblack_get_pool_stats(tree, &stats);
+    printf("pool slabs:%zu,live:%zu,free:%zu\n", stats.slab_num, stats.live_node_num, stats.free_node_num);
+    RedBlackStats tree_stats;
+    redblack_get_stats(tree, &tree_stats);
+    printf("height:%zu,max height:%zu,black height:%zu,cmp:%"PRIu64",rotations:%"PRIu64"\n",
+        redblack_get_height(tree), tree_stats.max_height, tree_stats.black_height, tree_stats.cmp_num, tree_stats.rotate_left_num + tree_stats.rotate_right_num);
     redblack_free(tree);
+
+    printf("--------------\n");
+    score_key_tree key_tree;
+    score_key_init(&key_tree);
+    for(uint64_t i = 0;i < 20;i++)
+        score_key_insert(&key_tree, i * 7 % 20);
+    assert(!score_key_insert(&key_tree, 3));
+    assert(score_key_delete(&key_tree, 3));
+    assert(!score_key_delete(&key_tree, 3));
+    assert(!score_key_delete(&key_tree, 100));
+    score_key_delete_min(&key_tree);
+    score_key_delete_max(&key_tree);
+    printf("typed size:%zu,rank of 10:%zu,rank of 3:%zu\n", score_key_size(&key_tree),
+        score_key_rank_of(&key_tree, 10), score_key_rank_of(&key_tree, 3));
+    score_key_get_range_by_rank(&key_tree, 1, 5, traverse_key_func);
+    score_key_free(&key_tree);
+
+    printf("--------------\n");
+    RedBlackBST *batch_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    void *sorted_scores[8];
+    for(int i = 0;i < 8;i++)
+        sorted_scores[i] = make_score(i, i * 10);
+    redblack_build_sorted(batch_tree, sorted_scores, 8);
+    void *batch_scores[4];
+    for(int i = 0;i < 4;i++)
+        batch_scores[i] = make_score(8 + i, 75 - i * 20);
+    redblack_insert_batch(batch_tree, batch_scores, 4);
+    uint64_t batch_expected[] = {0, 10, 15, 20, 30, 35, 40, 50, 55, 60, 70, 75};
+    assert(redblack_get_node_num(batch_tree) == 12);
+    for(size_t i = 0;i < 12;i++)
+        assert(((Score *)redblack_get_by_rank(batch_tree, i + 1))->score == batch_expected[i]);
+    printf("batch size:%zu,height:%zu\n", redblack_get_node_num(batch_tree), redblack_get_height(batch_tree));
+    redblack_free(batch_tree);
+
+    printf("--------------\n");
+    RedBlackBST *save_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    for(int i = 0;i < 10;i++)
+        redblack_insert(save_tree, make_score(i, 100 - i * 3));
+    int fd = open("redblack_snapshot.bin", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0 && redblack_save(save_tree, fd, serialize_func) == 0);
+    RedBlackBST *load_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    assert(lseek(fd, 0, SEEK_SET) == 0 && redblack_load(load_tree, fd, deserialize_func) == 0);
+    assert(redblack_get_node_num(load_tree) == 10);
+    for(size_t rank = 1;rank <= 10;rank++) {
+        Score *saved = redblack_get_by_rank(save_tree, rank);
+        Score *loaded = redblack_get_by_rank(load_tree, rank);
+        assert(saved->roleid == loaded->roleid && saved->score == loaded->score);
+    }
+    RedBlackBST *reject_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    assert(lseek(fd, 0, SEEK_SET) == 0 && redblack_load(reject_tree, fd, reject_func) == -1 && errno == EINVAL);
+    assert(redblack_is_empty(reject_tree));
+    close(fd);
+    remove("redblack_snapshot.bin");
+    printf("loaded:%zu,min score:%"PRIu64"\n", redblack_get_node_num(load_tree),
+        ((Score *)redblack_get_min(load_tree))->score);
+    redblack_free(reject_tree);
+    redblack_free(load_tree);
+    redblack_free(save_tree);
+
+    printf("--------------\n");
+    RedBlackBST *node_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    RedBlackBST *btree = redblack_new_btree(cmp_func, update_func, free_func, get_key_func);
+    for(int i = 0;i < 200;i++) {
+        redblack_insert(node_tree, make_score(i, i * 37 % 50));
+        redblack_insert(btree, make_score(i, i * 37 % 50));
+    }
+    for(int i = 0;i < 200;i += 3) {
+        Score score = {i, i * 37 % 50};
+        assert(redblack_delete(node_tree, &score) && redblack_delete(btree, &score));
+    }
+    check_same_order(node_tree, btree);
+    Score btree_min = {0, 10};
+    Score btree_max = {0, 20};
+    assert(redblack_count_in_score_range(btree, &btree_min, &btree_max, cmp_score_func) ==
+        redblack_count_in_score_range(node_tree, &btree_min, &btree_max, cmp_score_func));
+    printf("btree size:%zu,rank 100 score:%"PRIu64"\n", redblack_get_node_num(btree),
+        ((Score *)redblack_get_by_rank(btree, 100))->score);
+    redblack_free(btree);
+    redblack_free(node_tree);
+
+    printf("--------------\n");
+    RedBlackBST *split_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    for(int i = 0;i < 20;i++)
+        redblack_insert(split_tree, make_score(i, i * 5));
+    Score split_score = {10, 50};
+    RedBlackBST *split_left, *split_right;
+    redblack_split(split_tree, &split_score, &split_left, &split_right);
+    assert(split_left == split_tree);
+    assert(redblack_get_node_num(split_left) == 10 && redblack_get_node_num(split_right) == 10);
+    assert(((Score *)redblack_get_max(split_left))->score == 45 && ((Score *)redblack_get_min(split_right))->score == 50);
+    redblack_join(split_left, split_right);
+    RedBlackBST *union_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    for(int i = 15;i < 25;i++)
+        redblack_insert(union_tree, make_score(i, i * 5));
+    redblack_union(split_tree, union_tree);
+    assert(redblack_get_node_num(split_tree) == 25);
+    for(size_t rank = 1;rank <= 25;rank++)
+        assert(((Score *)redblack_get_by_rank(split_tree, rank))->roleid == rank - 1);
+    printf("union size:%zu,height:%zu\n", redblack_get_node_num(split_tree), redblack_get_height(split_tree));
+    redblack_free(split_tree);
+
+    printf("--------------\n");
+    RedBlackBST *sum_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    redblack_set_aggregate_func(sum_tree, sum_aggregate_func, sizeof(uint64_t));
+    for(int i = 0;i < 20;i++)
+        redblack_insert(sum_tree, make_score(i, i * 5));
+    uint64_t rank_sum = 0, score_range_sum = 0;
+    assert(redblack_aggregate_by_rank(sum_tree, 3, 7, &rank_sum) && rank_sum == 100);
+    Score sum_min = {0, 50};
+    Score sum_max = {0, 70};
+    Score sum_deleted = {12, 60};
+    redblack_delete(sum_tree, &sum_deleted);
+    assert(redblack_aggregate_by_score(sum_tree, &sum_min, &sum_max, cmp_score_func, &score_range_sum));
+    assert(score_range_sum == 240);
+    assert(!redblack_aggregate_by_rank(sum_tree, 30, 40, &rank_sum) && rank_sum == 100);
+    printf("rank 3-7 sum:%"PRIu64",score 50-70 sum:%"PRIu64"\n", rank_sum, score_range_sum);
+    redblack_free(sum_tree);
+
+    printf("--------------\n");
+    RedBlackBST *upsert_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    redblack_set_id_func(upsert_tree, get_id_func);
+    for(int i = 0;i < 10;i++)
+        redblack_insert(upsert_tree, make_score(i, i * 10));
+    void *upsert_scores[2] = {make_score(2, 95), make_score(20, 5)};
+    redblack_upsert_batch(upsert_tree, upsert_scores, 2);
+    assert(redblack_get_node_num(upsert_tree) == 11);
+    assert(((Score *)redblack_get_by_id(upsert_tree, 2))->score == 95);
+    assert(((Score *)redblack_get_by_rank(upsert_tree, 2))->roleid == 20);
+    assert(((Score *)redblack_get_max(upsert_tree))->roleid == 2);
+    RedBlackWriteBuffer *write_buffer = redblack_write_buffer_new(upsert_tree, get_id_func, free_func, 4,
+        UINT64_MAX);
+    redblack_write_buffer_put(write_buffer, make_score(30, 1));
+    redblack_write_buffer_put(write_buffer, make_score(31, 2));
+    redblack_write_buffer_put(write_buffer, make_score(30, 3));
+    assert(redblack_write_buffer_get_pending_num(write_buffer) == 2);
+    assert(redblack_get_node_num(upsert_tree) == 11 && redblack_get_by_id(upsert_tree, 30) == NULL);
+    redblack_write_buffer_flush(write_buffer);
+    assert(redblack_write_buffer_get_pending_num(write_buffer) == 0);
+    assert(redblack_get_node_num(upsert_tree) == 13 && ((Score *)redblack_get_by_id(upsert_tree, 30))->score == 3);
+    printf("upsert size:%zu,min roleid:%"PRIu64"\n", redblack_get_node_num(upsert_tree),
+        ((Score *)redblack_get_min(upsert_tree))->roleid);
+    redblack_write_buffer_free(write_buffer);
+    redblack_free(upsert_tree);
+
+    printf("--------------\n");
+    RedBlackBST *shard_trees[4];
+    for(int i = 0;i < 4;i++)
+        shard_trees[i] = redblack_new(cmp_func, update_func, free_func, NULL);
+    RedBlackShard *shard = redblack_shard_new(shard_trees, 4, cmp_func, get_id_func);
+    for(uint64_t i = 0;i < 40;i++) {
+        RedBlackBST *shard_tree = redblack_shard_write_begin(shard, i);
+        redblack_insert(shard_tree, make_score(i, i * 7 % 40));
+        redblack_shard_write_end(shard, i);
+    }
+    redblack_shard_read_begin(shard);
+    assert(redblack_shard_get_node_num(shard) == 40);
+    for(size_t rank = 1;rank <= 40;rank++) {
+        Score *shard_score = redblack_shard_get_by_rank(shard, rank);
+        assert(shard_score->score == rank - 1 && redblack_shard_rank_of(shard, shard_score) == rank);
+    }
+    void *shard_top[3];
+    assert(redblack_shard_top_n(shard, 3, shard_top) == 3);
+    for(size_t i = 0;i < 3;i++)
+        assert(((Score *)shard_top[i])->score == 39 - i);
+    printf("shard size:%zu,top roleid:%"PRIu64"\n", redblack_shard_get_node_num(shard), ((Score *)shard_top[0])->roleid);
+    redblack_shard_read_end(shard);
+    redblack_shard_free(shard);
+
+    printf("--------------\n");
+    RedBlackBST *plain_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    RedBlackBST *compact_tree = redblack_new_compact(cmp_func, update_func, free_func);
+    for(int i = 0;i < 200;i++) {
+        redblack_insert(plain_tree, make_score(i, i * 37 % 50));
+        redblack_insert(compact_tree, make_score(i, i * 37 % 50));
+    }
+    for(int i = 1;i < 200;i += 4) {
+        Score score = {i, i * 37 % 50};
+        void *plain_removed, *compact_removed;
+        assert(redblack_remove(plain_tree, &score, &plain_removed) && redblack_remove(compact_tree, &score, &compact_removed));
+        free_func(plain_removed);
+        free_func(compact_removed);
+    }
+    Score missing_score = {1, 37};
+    assert(!redblack_delete(compact_tree, &missing_score));
+    redblack_delete_min(plain_tree);
+    redblack_delete_min(compact_tree);
+    redblack_delete_max(plain_tree);
+    redblack_delete_max(compact_tree);
+    check_same_order(plain_tree, compact_tree);
+    printf("compact size:%zu,rank 100 score:%"PRIu64"\n", redblack_get_node_num(compact_tree),
+        ((Score *)redblack_get_by_rank(compact_tree, 100))->score);
+    redblack_free(compact_tree);
+    redblack_free(plain_tree);
+
+    printf("--------------\n");
+    RedBlackReclaimer *reclaimer = redblack_reclaimer_new(false);
+    RedBlackBST *deferred_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    for(int i = 0;i < 100;i++)
+        redblack_insert(deferred_tree, make_score(i, i));
+    redblack_free_deferred(reclaimer, deferred_tree);
+    size_t reclaim_num = 0;
+    while(redblack_reclaim(reclaimer, 16))
+        reclaim_num++;
+    assert(reclaim_num == 100 / 16);
+    redblack_reclaimer_free(reclaimer);
+    RedBlackReclaimer *background_reclaimer = redblack_reclaimer_new(true);
+    deferred_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    for(int i = 0;i < 100;i++)
+        redblack_insert(deferred_tree, make_score(i, i));
+    redblack_free_deferred(background_reclaimer, deferred_tree);
+    redblack_reclaimer_free(background_reclaimer);
+    Score borrowed_scores[10];
+    RedBlackBST *borrowed_tree = redblack_new(cmp_func, update_func, NULL, NULL);
+    for(int i = 0;i < 10;i++) {
+        borrowed_scores[i].roleid = i;
+        borrowed_scores[i].score = i;
+        redblack_insert(borrowed_tree, &borrowed_scores[i]);
+    }
+    redblack_free(borrowed_tree);
+    assert(borrowed_scores[9].roleid == 9);
+    printf("reclaim calls:%zu\n", reclaim_num);
+
+    printf("--------------\n");
+    RedBlackBST *range_tree = redblack_new(cmp_func, update_func, free_func, NULL);
+    redblack_set_id_func(range_tree, get_id_func);
+    for(int i = 0;i < 20;i++)
+        redblack_insert(range_tree, make_score(i, i * 5));
+    assert(redblack_delete_range_by_rank(range_tree, 5, 9) == 5);
+    Score range_min = {0, 50};
+    Score range_max = {0, 70};
+    assert(redblack_delete_range_by_score(range_tree, &range_min, &range_max, cmp_score_func) == 5);
+    assert(redblack_delete_range_by_rank(range_tree, 8, 100) == 3);
+    Score empty_min = {0, 200};
+    Score empty_max = {0, 300};
+    assert(redblack_delete_range_by_score(range_tree, &empty_min, &empty_max, cmp_score_func) == 0);
+    uint64_t range_expected[] = {0, 5, 10, 15, 45, 75, 80};
+    assert(redblack_get_node_num(range_tree) == 7);
+    for(size_t i = 0;i < 7;i++)
+        assert(((Score *)redblack_get_by_rank(range_tree, i + 1))->score == range_expected[i]);
+    assert(redblack_get_by_id(range_tree, 6) == NULL && redblack_get_by_id(range_tree, 9) != NULL);
+    printf("range left:%zu\n", redblack_get_node_num(range_tree));
+    redblack_free(range_tree);
     return 0;
 }